@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "batch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+static bool is_directory(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static bool is_regular_file(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+static bool has_image_extension(const std::string &path)
+{
+    static const char *extensions[] = {
+        ".jpg", ".jpeg", ".png", ".tif", ".tiff", ".bmp", ".ppm", ".pgm"
+    };
+
+    std::string::size_type dot = path.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = path.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+            ::tolower);
+
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (extension == extensions[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool collect_directory(const std::string &directory,
+        std::vector<std::string> &input_paths)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string path = directory + "/" + entry->d_name;
+        if (entry->d_name[0] != '.' && has_image_extension(path)
+                && is_regular_file(path)) {
+            input_paths.push_back(path);
+        }
+    }
+    closedir(dir);
+
+    // readdir() returns entries in no particular order; process spreads in
+    // name order instead.
+    std::sort(input_paths.begin(), input_paths.end());
+
+    return true;
+}
+
+static bool collect_glob(const std::string &pattern,
+        std::vector<std::string> &input_paths)
+{
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, NULL, &matches) != 0) {
+        globfree(&matches);
+        return false;
+    }
+
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        if (is_regular_file(matches.gl_pathv[i])) {
+            input_paths.push_back(matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+
+    return true;
+}
+
+static bool collect_manifest(const std::string &manifest,
+        std::vector<std::string> &input_paths)
+{
+    std::ifstream file(manifest.c_str());
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        // Trim surrounding whitespace (including a '\r' from DOS line endings).
+        std::string::size_type first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::string::size_type last = line.find_last_not_of(" \t\r");
+        input_paths.push_back(line.substr(first, last - first + 1));
+    }
+
+    return true;
+}
+
+bool collect_batch_inputs(const std::string &input_spec,
+        std::vector<std::string> &input_paths)
+{
+    bool ok;
+    if (is_directory(input_spec)) {
+        ok = collect_directory(input_spec, input_paths);
+    } else if (input_spec.find_first_of("*?[") != std::string::npos) {
+        ok = collect_glob(input_spec, input_paths);
+    } else {
+        ok = collect_manifest(input_spec, input_paths);
+    }
+
+    return ok && !input_paths.empty();
+}
+
+std::string batch_output_path(const std::string &output_dir,
+        const std::string &input_path, const std::string &page_suffix)
+{
+    // Split the input file name into its stem and extension.
+    std::string::size_type slash = input_path.rfind('/');
+    std::string name = (slash == std::string::npos)
+            ? input_path : input_path.substr(slash + 1);
+    std::string::size_type dot = name.rfind('.');
+    std::string stem = (dot == std::string::npos) ? name : name.substr(0, dot);
+    std::string extension = (dot == std::string::npos) ? ".jpg" : name.substr(dot);
+
+    return output_dir + "/" + stem + "-" + page_suffix + extension;
+}
+
+std::string batch_sidecar_path(const std::string &output_dir,
+        const std::string &input_path)
+{
+    std::string::size_type slash = input_path.rfind('/');
+    std::string name = (slash == std::string::npos)
+            ? input_path : input_path.substr(slash + 1);
+    std::string::size_type dot = name.rfind('.');
+    std::string stem = (dot == std::string::npos) ? name : name.substr(0, dot);
+
+    return output_dir + "/" + stem + ".markers";
+}
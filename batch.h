@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <string>
+#include <vector>
+
+// Expand a batch input specification into a list of image paths.
+// The specification can be a directory (every image-like file directly
+// inside it is used), a shell-style glob pattern (e.g., "scans/*.jpg"), or a
+// manifest file listing one input path per line (blank lines and lines
+// starting with '#' are ignored; the manifest order is kept). Returns false
+// if nothing could be read.
+bool collect_batch_inputs(const std::string &input_spec,
+        std::vector<std::string> &input_paths);
+
+// Build the output path for one page of a spread, in the same form that the
+// example folder-watching script uses: "<output_dir>/<name>-left_page.jpg".
+std::string batch_output_path(const std::string &output_dir,
+        const std::string &input_path, const std::string &page_suffix);
+
+// Build the path of the markers sidecar for a spread (see MarkerSidecar),
+// which sits with its pages: "<output_dir>/<name>.markers".
+std::string batch_sidecar_path(const std::string &output_dir,
+        const std::string &input_path);
+
+#endif
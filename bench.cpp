@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/////////////////////////////////////////////
+// Microbenchmarks for the detection and page-rendering hot paths.
+//
+// Each benchmark runs on a synthetic spread (see synth.h), rendered in
+// memory, so that results can be compared across machines, OpenCV versions
+// and code changes without needing any particular scans. As the glyphs'
+// positions are known exactly, how accurately they were found is reported
+// too, so that speed can be weighed against accuracy.
+/////////////////////////////////////////////
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <docopt-0.6.2/docopt.h> // For parsing command line arguments.
+
+#include "marker.h"
+#include "page.h"
+#include "synth.h"
+#include "threshold.h"
+#include "tracker.h"
+#include "warp.h"
+
+static const char USAGE[] =
+R"(voussoir_bench.
+    Description:
+      Times voussoir's glyph detection and page rendering on synthetic two-page spreads, and reports the time per operation (ns/op) and throughput (MB/s) of each step.
+
+    Usage:
+      voussoir_bench [options]
+      voussoir_bench (-h | --help)
+
+    Options:
+      -h --help  Show this screen.
+      --megapixels=<list>  Comma-separated spread sizes to test, in megapixels (e.g., 2,12,24,50,100). [default: 2,12,24]
+      --markers=<list>  Comma-separated numbers of glyphs to place on each spread (8 to 16; the first 8 frame the pages). [default: 8,16]
+      --clutter=<list>  Comma-separated numbers of dark, glyph-sized distractor shapes to scatter over each spread. [default: 0,200,2000]
+      --perspective=<perspective>  How far each corner of the spreads is pulled in, as a fraction of the shorter side (see voussoir_synth). [default: 0.05]
+      --lighting=<lighting>  How much darker one side of the spreads is than the other (0 to 1). [default: 0.3]
+      --blur=<blur>  The sigma of the Gaussian blur applied to the spreads, in pixels. [default: 1.0]
+      --noise=<noise>  The standard deviation of the noise added to the spreads, in gray levels. [default: 4]
+      --dpi=<dpi>  The DPI at which pages are rendered. [default: 300]
+      --min-time=<seconds>  The minimum time to spend timing each step. [default: 0.5]
+)";
+
+/////////////////////////////////////////////
+
+struct BenchConfig
+{
+    double megapixels;
+    int markers;
+    int clutter;
+};
+
+static std::vector<double> parse_list(const std::string &list)
+{
+    std::vector<double> values;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(stod(item));
+    }
+    return values;
+}
+
+// Run body repeatedly (doubling the number of runs) until at least
+// min_seconds have passed, and return the average time per run.
+template <typename Body>
+static double measure_ns_per_op(Body body, double min_seconds)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    body(); // Warm up.
+
+    for (long iterations = 1; ; iterations *= 2) {
+        Clock::time_point start = Clock::now();
+        for (long i = 0; i < iterations; i++) {
+            body();
+        }
+        double elapsed_ns = std::chrono::duration<double, std::nano>(
+                Clock::now() - start).count();
+        if (elapsed_ns >= min_seconds * 1e9) {
+            return elapsed_ns / iterations;
+        }
+    }
+}
+
+static void report(const char *name, const BenchConfig &config,
+        double ns_per_op, double bytes_per_op)
+{
+    printf("%-40s %6.1f MP %3d markers %5d clutter %15.0f ns/op %10.1f MB/s\n",
+            name, config.megapixels, config.markers, config.clutter,
+            ns_per_op, bytes_per_op / ns_per_op * 1e3);
+    fflush(stdout);
+}
+
+static void bench_decode_marker(const BenchConfig &config, double min_seconds)
+{
+    // A mix of valid glyphs in every rotation and random (mostly invalid)
+    // cell patterns, like the candidates seen on a real page.
+    std::vector<uint64_t> candidates;
+    CvRNG rng = cvRNG(1);
+    for (int i = 0; i < 1024; i++) {
+        if (i % 4 == 0) {
+            uint64_t cells = encode_marker(i % 16);
+            // Rotate by 90 degrees (i / 4) % 4 times.
+            for (int r = 0; r < (i / 4) % 4; r++) {
+                uint64_t rotated = 0;
+                for (int row = 0; row < 6; row++) {
+                    for (int col = 0; col < 6; col++) {
+                        if ((cells >> (row * 6 + col)) & 1) {
+                            rotated |= uint64_t(1) << (col * 6 + (5 - row));
+                        }
+                    }
+                }
+                cells = rotated;
+            }
+            candidates.push_back(cells);
+        } else {
+            candidates.push_back(((uint64_t(cvRandInt(&rng)) << 32)
+                    | cvRandInt(&rng)) & ((uint64_t(1) << 36) - 1));
+        }
+    }
+
+    volatile int sink = 0;
+    double ns = measure_ns_per_op([&] {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            marker_rotation_t rotation;
+            sink += decode_marker(candidates[i], rotation);
+        }
+    }, min_seconds);
+    report("decode_marker", config, ns / candidates.size(), sizeof(uint64_t));
+}
+
+static void bench_threshold(const BenchConfig &config,
+        const IplImage *src_img, double min_seconds)
+{
+    // OpenCV's grayscale conversion and adaptive threshold, against the
+    // fused kernel BookImage uses, which must give the same images.
+    CvSize size = cvGetSize(src_img);
+    IplImage *gray_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *bw_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *fused_gray_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *fused_bw_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    std::vector<unsigned int> sums;
+    double src_bytes = static_cast<double>(src_img->height) * src_img->widthStep;
+
+    double ns = measure_ns_per_op([&] {
+        cvCvtColor(src_img, gray_img, CV_BGR2GRAY);
+        cvAdaptiveThreshold(gray_img, bw_img, 128,
+                CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV, 11+20, 8);
+    }, min_seconds);
+    report("cvCvtColor + cvAdaptiveThreshold", config, ns, src_bytes);
+
+    ns = measure_ns_per_op([&] {
+        bgr_to_gray_threshold_mean_inv(src_img, fused_gray_img, fused_bw_img,
+                128, 11+20, 8, sums);
+    }, min_seconds);
+    std::string name = std::string("fused threshold (")
+            + threshold_kernel_name() + ")";
+    report(name.c_str(), config, ns, src_bytes);
+
+    if (cvNorm(gray_img, fused_gray_img, CV_L1) != 0.0
+            || cvNorm(bw_img, fused_bw_img, CV_L1) != 0.0) {
+        std::cerr << "Warning: the fused threshold differs from OpenCV's."
+                << std::endl;
+    }
+
+    cvReleaseImage(&fused_bw_img);
+    cvReleaseImage(&fused_gray_img);
+    cvReleaseImage(&bw_img);
+    cvReleaseImage(&gray_img);
+}
+
+static void bench_warp(const BenchConfig &config, const IplImage *src_img,
+        double min_seconds)
+{
+    // OpenCV's perspective warp, against the one BookImage uses, which must
+    // give the same page to within a gray level: onto a page the size of
+    // the spread, through a slightly keystoned mapping.
+    double h[9] = { 1.05, 0.02, -0.02 * src_img->width,
+                    -0.01, 1.04, 0.01 * src_img->height,
+                    2e-6, 1e-6, 1.0 };
+    CvMat h_mat = cvMat(3, 3, CV_64FC1, h);
+    IplImage *page_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 3);
+    IplImage *warped_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 3);
+    double page_bytes = static_cast<double>(page_img->height) * page_img->widthStep;
+
+    double ns = measure_ns_per_op([&] {
+        cvWarpPerspective(src_img, page_img, &h_mat);
+    }, min_seconds);
+    report("cvWarpPerspective", config, ns, page_bytes);
+
+    ns = measure_ns_per_op([&] {
+        warp_perspective(src_img, warped_img, &h_mat);
+    }, min_seconds);
+    std::string name = std::string("warp_perspective (")
+            + warp_kernel_name() + ")";
+    report(name.c_str(), config, ns, page_bytes);
+
+    if (cvNorm(page_img, warped_img, CV_C) > 1.0) {
+        std::cerr << "Warning: the perspective warp differs from OpenCV's."
+                << std::endl;
+    }
+
+    cvReleaseImage(&warped_img);
+    cvReleaseImage(&page_img);
+}
+
+static void bench_analyze_marker(const BenchConfig &config,
+        const IplImage *src_img, double min_seconds)
+{
+    // Find the quadrilateral candidates the way BookImage does (among the
+    // outer contours, though without its pruning), and time only their
+    // analysis.
+    IplImage *gray_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 1);
+    cvCvtColor(src_img, gray_img, CV_BGR2GRAY);
+    IplImage *bw_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 1);
+    cvAdaptiveThreshold(gray_img, bw_img, 128,
+            CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV, 11+20, 8);
+    CvMemStorage *storage = cvCreateMemStorage(0);
+    CvSeq *contour;
+    cvFindContours(bw_img, storage, &contour, sizeof(CvContour),
+            CV_RETR_CCOMP, CV_CHAIN_APPROX_NONE, cvPoint(0,0));
+
+    std::vector<CvSeq *> candidates;
+    double candidate_pixels = 0.0;
+    for (; contour != 0; contour = contour->h_next) {
+        CvSeq *poly = cvApproxPoly(contour, sizeof(CvContour), NULL,
+                CV_POLY_APPROX_DP, 6.0);
+        if (poly->total == 4 && cvCheckContourConvexity(poly)) {
+            candidates.push_back(poly);
+            candidate_pixels += std::fabs(cvContourArea(poly));
+        }
+    }
+
+    if (!candidates.empty()) {
+        volatile int sink = 0;
+        double ns = measure_ns_per_op([&] {
+            for (size_t i = 0; i < candidates.size(); i++) {
+                CvPoint2D32f points[4];
+                sink += analyze_marker(gray_img, candidates[i], points);
+            }
+        }, min_seconds);
+        report("analyze_marker (per candidate)", config,
+                ns / candidates.size(), candidate_pixels / candidates.size());
+    }
+
+    cvReleaseMemStorage(&storage);
+    cvReleaseImage(&bw_img);
+    cvReleaseImage(&gray_img);
+}
+
+// How many of the glyphs drawn were found, and how far their corners are from
+// where they were drawn.
+static void report_accuracy(const BenchConfig &config,
+        const std::map<int, MarkerCorners> &found,
+        const std::map<int, MarkerCorners> &truth)
+{
+    int found_count = 0;
+    double error_sum = 0.0;
+    double error_max = 0.0;
+    typedef std::map<int, MarkerCorners>::const_iterator MCIT;
+    for (MCIT it = truth.begin(); it != truth.end(); ++it) {
+        MCIT fit = found.find(it->first);
+        if (fit == found.end()) {
+            continue;
+        }
+        found_count++;
+        // Match corners by position, so that this measures where the
+        // corners are rather than the order they're listed in.
+        for (int i = 0; i < 4; i++) {
+            double error = HUGE_VAL;
+            for (int j = 0; j < 4; j++) {
+                double dx = fit->second.points[j].x - it->second.points[i].x;
+                double dy = fit->second.points[j].y - it->second.points[i].y;
+                error = std::min(error, std::sqrt(dx * dx + dy * dy));
+            }
+            error_sum += error;
+            error_max = std::max(error_max, error);
+        }
+    }
+
+    printf("%-40s %6.1f MP %3d markers %5d clutter %6d/%-3d found %8.3f px mean %8.3f px max\n",
+            "accuracy", config.megapixels, config.markers, config.clutter,
+            found_count, static_cast<int>(truth.size()),
+            found_count > 0 ? error_sum / (4 * found_count) : 0.0, error_max);
+    fflush(stdout);
+}
+
+static void bench_book_image(const BenchConfig &config,
+        const IplImage *src_img, const std::vector<PageSpec> &pages,
+        const std::map<int, MarkerCorners> &truth, double min_seconds)
+{
+    double src_bytes = static_cast<double>(src_img->height) * src_img->widthStep;
+
+    double ns = measure_ns_per_op([&] {
+        BookImage book_img(src_img);
+    }, min_seconds);
+    report("BookImage::BookImage", config, ns, src_bytes);
+
+    // As for the frames of a sequence, with the glyphs where they were in
+    // the previous image.
+    MarkerTracker tracker(0);
+    DetectionOptions tracked_options;
+    tracked_options.tracker = &tracker;
+    ns = measure_ns_per_op([&] {
+        BookImage book_img(src_img, tracked_options);
+    }, min_seconds);
+    report("BookImage::BookImage (tracked)", config, ns, src_bytes);
+
+    BookImage book_img(src_img);
+    report_accuracy(config, book_img.markers(), truth);
+    for (size_t p = 0; p < pages.size(); p++) {
+        if (!book_img.has_markers(pages[p].dst_markers)) {
+            std::cerr << "Warning: the glyphs of page " << p
+                    << " were not all found; skipping the page benchmarks."
+                    << std::endl;
+            return;
+        }
+    }
+
+    // The CvSize overload, with the page's glyphs in pixels.
+    const LayoutInfo &layout = pages[0].layout;
+    CvSize page_size = cvSize(
+            cvRound((layout.page_right - layout.page_left) * layout.dpi),
+            cvRound((layout.page_bottom - layout.page_top) * layout.dpi));
+    std::map<int, CvPoint2D32f> dst_markers_px;
+    typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
+    for (MMCIT dit = pages[0].dst_markers.begin();
+            dit != pages[0].dst_markers.end(); ++dit) {
+        dst_markers_px[dit->first] = cvPoint2D32f(
+                dit->second.x * layout.dpi, dit->second.y * layout.dpi);
+    }
+    double page_bytes = 3.0 * page_size.width * page_size.height;
+
+    ns = measure_ns_per_op([&] {
+        IplImage *page_img = book_img.create_page_image(dst_markers_px,
+                page_size);
+        cvReleaseImage(&page_img);
+    }, min_seconds);
+    report("create_page_image (size)", config, ns, page_bytes);
+
+    ns = measure_ns_per_op([&] {
+        IplImage *page_img = book_img.create_page_image(pages[0].dst_markers,
+                pages[0].layout);
+        cvReleaseImage(&page_img);
+    }, min_seconds);
+    report("create_page_image (layout)", config, ns, page_bytes);
+}
+
+int main(int argc, const char** argv)
+{
+    std::map<std::string, docopt::value> args
+        = docopt::docopt(USAGE, { argv + 1, argv + argc }, true);
+
+    std::vector<double> megapixels = parse_list(args["--megapixels"].asString());
+    std::vector<double> marker_counts = parse_list(args["--markers"].asString());
+    std::vector<double> clutter_levels = parse_list(args["--clutter"].asString());
+    double dpi = stod(args["--dpi"].asString());
+    double min_seconds = stod(args["--min-time"].asString());
+
+    SynthOptions synth_options;
+    synth_options.perspective = stod(args["--perspective"].asString());
+    synth_options.lighting = stod(args["--lighting"].asString());
+    synth_options.blur = stod(args["--blur"].asString());
+    synth_options.noise = stod(args["--noise"].asString());
+
+    // Nobody is watching the marker debugging window here.
+    show_marker_debug_window = false;
+
+    // create_page_image reports which markers it recognized on every call;
+    // keep that out of the results.
+    std::streambuf *cout_buffer = std::cout.rdbuf();
+    std::ostringstream discarded;
+
+    for (size_t m = 0; m < megapixels.size(); m++) {
+        for (size_t k = 0; k < marker_counts.size(); k++) {
+            for (size_t c = 0; c < clutter_levels.size(); c++) {
+                BenchConfig config;
+                config.megapixels = megapixels[m];
+                config.markers = static_cast<int>(marker_counts[k]);
+                config.clutter = static_cast<int>(clutter_levels[c]);
+
+                synth_options.megapixels = config.megapixels;
+                synth_options.markers = config.markers;
+                synth_options.clutter = config.clutter;
+                SynthSpread spread = create_synthetic_spread(synth_options, dpi);
+
+                std::cout.rdbuf(discarded.rdbuf());
+                bench_decode_marker(config, min_seconds);
+                bench_threshold(config, spread.img, min_seconds);
+                bench_warp(config, spread.img, min_seconds);
+                bench_analyze_marker(config, spread.img, min_seconds);
+                bench_book_image(config, spread.img, spread.pages,
+                        spread.markers, min_seconds);
+                std::cout.rdbuf(cout_buffer);
+                discarded.str("");
+
+                cvReleaseImage(&spread.img);
+            }
+        }
+    }
+
+    return 0;
+}
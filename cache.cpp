@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "cache.h"
+#include "hash.h"
+
+static const char *TEMP_PREFIX = ".tmp-";
+
+static std::string page_file_name(size_t index)
+{
+    std::ostringstream name;
+    name << "page" << index;
+    return name.str();
+}
+
+// The names of the files in a directory, apart from "." and "..".
+static std::vector<std::string> list_directory(const std::string &path)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return names;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+static void remove_directory(const std::string &path)
+{
+    std::vector<std::string> names = list_directory(path);
+    for (size_t i = 0; i < names.size(); i++) {
+        unlink((path + "/" + names[i]).c_str());
+    }
+    rmdir(path.c_str());
+}
+
+static uint64_t directory_size(const std::string &path)
+{
+    uint64_t size = 0;
+    std::vector<std::string> names = list_directory(path);
+    for (size_t i = 0; i < names.size(); i++) {
+        struct stat info;
+        if (stat((path + "/" + names[i]).c_str(), &info) == 0) {
+            size += info.st_size;
+        }
+    }
+    return size;
+}
+
+// Make a hard link to from, or failing that (e.g., if they're on different
+// file systems), a copy of it.
+static bool link_or_copy(const std::string &from, const std::string &to)
+{
+    if (link(from.c_str(), to.c_str()) == 0) {
+        return true;
+    }
+
+    std::ifstream source(from.c_str(), std::ios::binary);
+    std::ofstream destination(to.c_str(), std::ios::binary);
+    if (!source || !destination) {
+        return false;
+    }
+    destination << source.rdbuf();
+    destination.close();
+    return !destination.fail();
+}
+
+static bool same_file(const std::string &a, const std::string &b)
+{
+    struct stat a_info;
+    struct stat b_info;
+    return stat(a.c_str(), &a_info) == 0 && stat(b.c_str(), &b_info) == 0
+            && a_info.st_dev == b_info.st_dev && a_info.st_ino == b_info.st_ino;
+}
+
+ResultCache::ResultCache(const std::string &directory, uint64_t max_size)
+    : directory(directory), max_size(max_size), total_size(0), temp_counter(0)
+{
+}
+
+bool ResultCache::open()
+{
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    std::vector<std::string> names = list_directory(directory);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string path = directory + "/" + names[i];
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            continue;
+        }
+        if (names[i].compare(0, 5, TEMP_PREFIX) == 0) {
+            // Left behind by a run that was interrupted while storing.
+            remove_directory(path);
+            continue;
+        }
+        Entry entry;
+        entry.size = directory_size(path);
+        entry.last_used = info.st_mtime;
+        entries[names[i]] = entry;
+        total_size += entry.size;
+    }
+    evict();
+
+    return access(directory.c_str(), W_OK) == 0;
+}
+
+bool ResultCache::restore(const std::string &key,
+        const std::vector<std::string> &output_paths)
+{
+    // Hold the lock throughout, so that the entry can't be evicted while its
+    // pages are being linked.
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, Entry>::iterator entry = entries.find(key);
+    if (entry == entries.end()) {
+        return false;
+    }
+
+    std::string path = directory + "/" + key;
+    for (size_t i = 0; i < output_paths.size(); i++) {
+        std::string page_path = path + "/" + page_file_name(i);
+        if (access(page_path.c_str(), F_OK) != 0
+                || same_file(page_path, output_paths[i])) {
+            continue;
+        }
+        unlink(output_paths[i].c_str());
+        if (!link_or_copy(page_path, output_paths[i])) {
+            return false;
+        }
+    }
+
+    // Mark the entry as used just now, here and on disk (for later runs).
+    utime(path.c_str(), NULL);
+    entry->second.last_used = time(NULL);
+    return true;
+}
+
+void ResultCache::store(const std::string &key,
+        const std::vector<std::string> &output_paths)
+{
+    std::string temp_path;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.find(key) != entries.end()) {
+            return;
+        }
+        std::ostringstream name;
+        name << directory << "/" << TEMP_PREFIX << key << "-" << temp_counter++;
+        temp_path = name.str();
+    }
+
+    if (mkdir(temp_path.c_str(), 0777) != 0) {
+        return;
+    }
+    uint64_t size = 0;
+    for (size_t i = 0; i < output_paths.size(); i++) {
+        if (output_paths[i].empty()) {
+            continue;
+        }
+        struct stat info;
+        if (stat(output_paths[i].c_str(), &info) != 0 || !link_or_copy(
+                output_paths[i], temp_path + "/" + page_file_name(i))) {
+            remove_directory(temp_path);
+            return;
+        }
+        size += info.st_size;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string path = directory + "/" + key;
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Another thread stored the same spread (e.g., a duplicate image).
+        remove_directory(temp_path);
+        return;
+    }
+    Entry entry;
+    entry.size = size;
+    entry.last_used = time(NULL);
+    entries[key] = entry;
+    total_size += size;
+    evict();
+}
+
+void ResultCache::evict()
+{
+    while (total_size > max_size && !entries.empty()) {
+        std::map<std::string, Entry>::iterator oldest = entries.begin();
+        for (std::map<std::string, Entry>::iterator it = entries.begin();
+                it != entries.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) {
+                oldest = it;
+            }
+        }
+        remove_directory(directory + "/" + oldest->first);
+        total_size -= oldest->second.size;
+        entries.erase(oldest);
+    }
+}
+
+std::string result_cache_key(uint64_t content_hash, const std::string &settings)
+{
+    char key[34];
+    snprintf(key, sizeof(key), "%016llx-%016llx",
+            static_cast<unsigned long long>(content_hash),
+            static_cast<unsigned long long>(
+                fnv1a_hash(settings.data(), settings.size())));
+    return key;
+}
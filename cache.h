@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+// An on-disk cache of the pages cut out of each spread, so that a batch run
+// over images that were already processed (with the same settings) only has
+// to put the pages back, not make them again; this also lets an interrupted
+// run pick up where it stopped.
+//
+// Each entry is a directory named after its key, holding a hard link to each
+// page ("page0", "page1", ..., none for pages whose markers weren't found), so
+// the cache costs no extra disk space while the pages are still in the output
+// directory. (So a page must be replaced by removing it and writing a new file,
+// never by writing over it, or the entry would change too.) Entries are built
+// under a temporary name and renamed into place, so a half-written entry is
+// never used. When the cache grows past its size limit, the entries used
+// longest ago are removed.
+//
+// The methods can be called from several threads at once.
+class ResultCache
+{
+private:
+    struct Entry
+    {
+        uint64_t size; // Bytes.
+        time_t last_used;
+    };
+
+    std::string directory;
+    uint64_t max_size;
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    uint64_t total_size;
+    unsigned long temp_counter;
+
+    void evict();
+
+public:
+    // A cache in directory, holding at most max_size bytes of pages.
+    ResultCache(const std::string &directory, uint64_t max_size);
+
+    // Create the cache directory if need be, and take stock of the entries
+    // already in it. Returns false if it can't be used.
+    bool open();
+
+    // If there is an entry for key, put its pages at output_paths (one per
+    // page, in the order they were stored) and return true; pages that are
+    // already there are left alone.
+    bool restore(const std::string &key,
+            const std::vector<std::string> &output_paths);
+
+    // Add the pages just saved at output_paths (an empty path for a page
+    // that wasn't made) as the entry for key.
+    void store(const std::string &key,
+            const std::vector<std::string> &output_paths);
+};
+
+// The key of a spread's entry: the hash of its input image (see hash_file),
+// and of a description of every setting that changes its pages.
+std::string result_cache_key(uint64_t content_hash,
+        const std::string &settings);
+
+#endif
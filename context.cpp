@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "context.h"
+#include "page.h"
+
+// Make sure buffer can hold a size image with `channels` channels, growing
+// (reallocating) it only if it's too small.
+static void reserve_image(IplImage *&buffer, CvSize size, int channels)
+{
+    if (buffer != NULL && buffer->width >= size.width
+            && buffer->height >= size.height) {
+        return;
+    }
+    CvSize new_size = cvSize(size.width, size.height);
+    if (buffer != NULL) {
+        new_size.width = std::max(new_size.width, buffer->width);
+        new_size.height = std::max(new_size.height, buffer->height);
+        cvReleaseImage(&buffer);
+    }
+    buffer = cvCreateImage(new_size, IPL_DEPTH_8U, channels);
+}
+
+// A header for the top left size pixels of buffer (sharing its data).
+static IplImage image_view(const IplImage *buffer, CvSize size)
+{
+    IplImage view;
+    cvInitImageHeader(&view, size, IPL_DEPTH_8U, buffer->nChannels);
+    cvSetData(&view, buffer->imageData, buffer->widthStep);
+    return view;
+}
+
+DetectionContext::DetectionContext()
+    : gray_buffer(NULL), threshold_buffer(NULL), storage(NULL)
+{
+}
+
+DetectionContext::~DetectionContext()
+{
+    cvReleaseImage(&gray_buffer);
+    cvReleaseImage(&threshold_buffer);
+    for (size_t i = 0; i < pyramid_buffers.size(); i++) {
+        cvReleaseImage(&pyramid_buffers[i]);
+    }
+    if (storage != NULL) {
+        cvReleaseMemStorage(&storage);
+    }
+}
+
+IplImage DetectionContext::gray_image(CvSize size)
+{
+    reserve_image(gray_buffer, size, 1);
+    return image_view(gray_buffer, size);
+}
+
+IplImage DetectionContext::threshold_image(CvSize size)
+{
+    reserve_image(threshold_buffer, size, 1);
+    return image_view(threshold_buffer, size);
+}
+
+IplImage DetectionContext::pyramid_image(int level, CvSize size)
+{
+    if (pyramid_buffers.size() <= static_cast<size_t>(level)) {
+        pyramid_buffers.resize(level + 1, NULL);
+    }
+    reserve_image(pyramid_buffers[level], size, 1);
+    return image_view(pyramid_buffers[level], size);
+}
+
+CvMemStorage *DetectionContext::memory_storage()
+{
+    if (storage == NULL) {
+        storage = cvCreateMemStorage(0);
+    } else {
+        cvClearMemStorage(storage);
+    }
+    return storage;
+}
+
+PageRenderer::PageRenderer(size_t max_free)
+    : max_free(max_free)
+{
+    free_imgs.reserve(max_free);
+}
+
+PageRenderer::~PageRenderer()
+{
+    for (size_t i = 0; i < free_imgs.size(); i++) {
+        cvReleaseImage(&free_imgs[i]);
+    }
+}
+
+IplImage *PageRenderer::acquire(CvSize size, int channels)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < free_imgs.size(); i++) {
+            IplImage *img = free_imgs[i];
+            if (img->width == size.width && img->height == size.height
+                    && img->nChannels == channels) {
+                free_imgs.erase(free_imgs.begin() + i);
+                return img;
+            }
+        }
+    }
+    return cvCreateImage(size, IPL_DEPTH_8U, channels);
+}
+
+void PageRenderer::recycle(IplImage *&img)
+{
+    if (img == NULL) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_imgs.size() >= max_free) {
+        // Make room by dropping the oldest (least likely to be needed).
+        cvReleaseImage(&free_imgs.front());
+        free_imgs.erase(free_imgs.begin());
+    }
+    free_imgs.push_back(img);
+    img = NULL;
+}
+
+IplImage *PageRenderer::render(const BookImage &book_img,
+        const std::map<int, CvPoint2D32f> &dst_markers,
+        const LayoutInfo &layout)
+{
+    if (!book_img.has_markers(dst_markers)) {
+        // Let create_page_image report which marker is missing.
+        return book_img.create_page_image(dst_markers, layout);
+    }
+
+    IplImage *page_img = acquire(page_image_size(layout), 3);
+    if (!book_img.render_page_image(dst_markers, layout, page_img)) {
+        recycle(page_img);
+    }
+    return page_img;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CONTEXT_H
+#define _CONTEXT_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+#include "marker.h"
+
+struct LayoutInfo;
+class BookImage;
+
+// A quadrilateral found by the contour search, how likely it looks to be a
+// marker, and what analyze_marker made of it (an ID of -1 if it isn't a
+// marker, or wasn't analyzed).
+struct MarkerCandidate
+{
+    CvSeq *poly;
+    double squareness; // 1 for a square, less for other shapes.
+    double area;
+    MarkerCorners corners;
+    int id;
+    double confidence;
+};
+
+// The working buffers of marker detection (the grayscale, pyramid and
+// thresholded images, and the contour storage), kept from one image to the
+// next so that, once they have grown to the size of the images, detecting
+// markers allocates nothing. Pass one to BookImage through
+// DetectionOptions::context.
+//
+// A context is used by one BookImage at a time, so it must not be shared
+// between threads (give each worker its own).
+class DetectionContext
+{
+private:
+    IplImage *gray_buffer;
+    IplImage *threshold_buffer;
+    std::vector<IplImage *> pyramid_buffers;
+    CvMemStorage *storage;
+    std::vector<unsigned int> sums;
+    std::vector<MarkerCandidate> candidates;
+
+    DetectionContext(const DetectionContext &);
+    DetectionContext &operator=(const DetectionContext &);
+
+public:
+    DetectionContext();
+    ~DetectionContext();
+
+    // Each of these returns an image header for a size x size, 8-bit,
+    // single-channel image in one of the buffers, growing the buffer first
+    // if it's too small. The image stays valid until the same buffer is
+    // asked for again.
+    IplImage gray_image(CvSize size);
+    IplImage threshold_image(CvSize size);
+    IplImage pyramid_image(int level, CvSize size);
+
+    // An empty memory storage (for contours), reusing its blocks.
+    CvMemStorage *memory_storage();
+
+    // Working space for the threshold's running sums.
+    std::vector<unsigned int> &threshold_sums() { return sums; }
+
+    // The candidate markers of the current search.
+    std::vector<MarkerCandidate> &marker_candidates() { return candidates; }
+};
+
+// Renders pages into images taken from a pool, to which they are returned
+// once they've been saved or shown, so that the large page images (and
+// other whole-image buffers, like copies of captured frames) aren't
+// allocated afresh for every spread. Can be shared between threads.
+class PageRenderer
+{
+private:
+    std::mutex mutex;
+    std::vector<IplImage *> free_imgs;
+    size_t max_free;
+
+    PageRenderer(const PageRenderer &);
+    PageRenderer &operator=(const PageRenderer &);
+
+public:
+    // Keep up to max_free images for reuse.
+    explicit PageRenderer(size_t max_free = 16);
+    ~PageRenderer();
+
+    // An 8-bit image of the given size and number of channels, with
+    // undefined contents.
+    IplImage *acquire(CvSize size, int channels);
+
+    // Give an image back for reuse, and set img to NULL. (NULL is ignored.)
+    void recycle(IplImage *&img);
+
+    // Render a page of book_img into a pooled image, as
+    // BookImage::create_page_image does. Returns NULL if its markers weren't
+    // found; recycle the page when done with it.
+    IplImage *render(const BookImage &book_img,
+            const std::map<int, CvPoint2D32f> &dst_markers,
+            const LayoutInfo &layout);
+};
+
+#endif
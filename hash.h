@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <cstddef>
+#include <string>
+
+#include <stdint.h>
+
+// 64-bit FNV-1a hashes, for telling whether an input has changed since it
+// was last processed. (Not for anything needing resistance to tampering.)
+static const uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+
+// Hash size bytes of data, continuing from hash (so that data can be hashed
+// in pieces).
+uint64_t fnv1a_hash(const void *data, size_t size,
+        uint64_t hash = FNV1A_OFFSET_BASIS);
+
+// Hash the contents of a file. Returns false if it couldn't be read.
+bool hash_file(const std::string &path, uint64_t &hash);
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "context.h"
+#include "live.h"
+#include "stats.h"
+#include "tracker.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// A captured frame, and, once processed, the pages rendered from it. The
+// images come from (and go back to) the renderer's pool.
+struct LiveFrame
+{
+    PageRenderer *renderer;
+    long number;
+    Clock::time_point captured;
+    IplImage *src_img;
+    std::vector<IplImage *> page_imgs; // NULL for pages not found.
+
+    explicit LiveFrame(PageRenderer *renderer)
+        : renderer(renderer), number(0), src_img(NULL) {}
+    ~LiveFrame()
+    {
+        renderer->recycle(src_img);
+        for (size_t i = 0; i < page_imgs.size(); i++) {
+            renderer->recycle(page_imgs[i]);
+        }
+    }
+};
+
+}
+
+void LatencyHistogram::print(std::ostream &out) const
+{
+    if (samples.empty()) {
+        out << "No frames were displayed." << std::endl;
+        return;
+    }
+
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    char line[160];
+    snprintf(line, sizeof(line),
+            "Capture-to-display latency over %d frames: median %.1f ms, 90th percentile %.1f ms, 99th percentile %.1f ms, max %.1f ms.",
+            static_cast<int>(sorted.size()), sorted[sorted.size() / 2],
+            sorted[sorted.size() * 9 / 10], sorted[sorted.size() * 99 / 100],
+            sorted.back());
+    out << line << std::endl;
+
+    static const double bounds[] = { 10, 20, 33, 50, 67, 100, 150, 200, 300, 500, 1000 };
+    static const int number_of_bounds = sizeof(bounds) / sizeof(bounds[0]);
+    size_t begin = 0;
+    for (int b = 0; b <= number_of_bounds; b++) {
+        size_t end = (b < number_of_bounds)
+                ? std::lower_bound(sorted.begin(), sorted.end(), bounds[b]) - sorted.begin()
+                : sorted.size();
+        if (b < number_of_bounds) {
+            snprintf(line, sizeof(line), "    < %4.0f ms: %6d ", bounds[b],
+                    static_cast<int>(end - begin));
+        } else {
+            snprintf(line, sizeof(line), "   >= %4.0f ms: %6d ",
+                    bounds[number_of_bounds - 1], static_cast<int>(end - begin));
+        }
+        // A bar of up to 50 characters, relative to all frames.
+        out << line << std::string((end - begin) * 50 / sorted.size(), '#') << std::endl;
+        begin = end;
+    }
+}
+
+bool run_live(const std::vector<PageSpec> &pages, const LiveOptions &options)
+{
+    // Open the webcam, or the video file standing in for it.
+    CvCapture *capture;
+    double frame_interval = 0.0; // Seconds between video frames; 0 to not pace them.
+    if (options.video_path.empty()) {
+        capture = cvCreateCameraCapture(0);
+        if (!capture) {
+            return false;
+        }
+        const double scale = 1.0;
+        cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_WIDTH, 1600 * scale);
+        cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_HEIGHT, 1200 * scale);
+    } else {
+        capture = cvCreateFileCapture(options.video_path.c_str());
+        if (!capture) {
+            return false;
+        }
+        // Deliver the video's frames at its frame rate, as a camera would.
+        double fps = cvGetCaptureProperty(capture, CV_CAP_PROP_FPS);
+        if (fps > 0.0) {
+            frame_interval = 1.0 / fps;
+        }
+    }
+
+    if (!options.headless) {
+        cvNamedWindow("Source", 0);
+        cvResizeWindow("Source", 480, 640);
+    }
+
+    // Frames and pages are recycled rather than allocated afresh for every
+    // frame. (This must outlive the slots, which may still hold frames.)
+    PageRenderer renderer;
+    LatestSlot<LiveFrame> captured_frames;
+    LatestSlot<LiveFrame> processed_frames;
+    std::atomic<bool> stopping(false);
+    std::atomic<long> frames_captured(0);
+    std::atomic<long> frames_processed(0);
+
+    // Capture: grab frames as fast as the camera delivers them, whether or
+    // not the last one has been processed yet.
+    std::thread capture_thread([&] {
+        if (options.tracer != NULL) {
+            options.tracer->name_thread("capture");
+        }
+        Clock::time_point next_frame = Clock::now();
+        while (!stopping) {
+            IplImage *frame_img = cvQueryFrame(capture);
+            if (frame_img == NULL) {
+                break;
+            }
+            std::unique_ptr<LiveFrame> frame(new LiveFrame(&renderer));
+            frame->captured = Clock::now();
+            frame->number = ++frames_captured;
+            frame->src_img = renderer.acquire(cvGetSize(frame_img),
+                    frame_img->nChannels);
+            cvCopy(frame_img, frame->src_img); // frame_img belongs to capture.
+            captured_frames.put(std::move(frame));
+
+            if (frame_interval > 0.0) {
+                next_frame += std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(frame_interval));
+                std::this_thread::sleep_until(next_frame);
+            }
+        }
+        captured_frames.close();
+    });
+
+    // Process: find the glyphs in the newest frame (around where they were
+    // in the last one, if tracking), and render the pages.
+    MarkerTracker tracker(options.track_full_every);
+    DetectionContext context;
+    DetectionOptions detection = options.detection;
+    detection.context = &context;
+    if (options.track) {
+        detection.tracker = &tracker;
+    }
+    std::thread process_thread([&] {
+        if (options.tracer != NULL) {
+            options.tracer->name_thread("process");
+        }
+        std::unique_ptr<LiveFrame> frame;
+        while (captured_frames.take(frame, true)) {
+            ImageStats frame_stats;
+            frame_stats.trace_to(options.tracer,
+                    "frame " + std::to_string(frame->number));
+            BookImage book_img(frame->src_img, detection,
+                    options.session,
+                    (options.tracer != NULL) ? &frame_stats : NULL);
+            frame->page_imgs = book_img.create_page_images(pages,
+                    std::vector<std::string>(), &renderer);
+            frames_processed++;
+            processed_frames.put(std::move(frame));
+        }
+        processed_frames.close();
+    });
+
+    // Display (on this thread, which is the only one allowed to update the
+    // windows): show the newest processed frame.
+    static const char *window_names[] = {"Left", "Right"};
+    LatencyHistogram latency;
+    long frames_displayed = 0;
+    while (true) {
+        std::unique_ptr<LiveFrame> frame;
+        if (options.headless) {
+            if (!processed_frames.take(frame, true)) {
+                break;
+            }
+        } else {
+            if (cvWaitKey(10) >= 0) {
+                break;
+            }
+            if (!processed_frames.take(frame, false)) {
+                if (processed_frames.is_closed()) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        Clock::time_point display_start = Clock::now();
+        if (!options.headless) {
+            cvShowImage("Source", frame->src_img);
+            for (size_t i = 0; i < frame->page_imgs.size() && i < 2; i++) {
+                if (frame->page_imgs[i] != NULL) {
+                    cvShowImage(window_names[i], frame->page_imgs[i]);
+                }
+            }
+        }
+        Clock::time_point displayed = Clock::now();
+        if (options.tracer != NULL) {
+            options.tracer->record("display",
+                    "frame " + std::to_string(frame->number),
+                    display_start, displayed);
+        }
+
+        latency.add(std::chrono::duration<double, std::milli>(
+                displayed - frame->captured).count());
+        frames_displayed++;
+    }
+
+    // Stop capturing; processing stops once capture has.
+    stopping = true;
+    capture_thread.join();
+    process_thread.join();
+    cvReleaseCapture(&capture);
+
+    std::cout << "Captured " << frames_captured << " frames, processed "
+            << frames_processed << " (" << captured_frames.number_dropped()
+            << " dropped while processing was busy), and displayed "
+            << frames_displayed << " (" << processed_frames.number_dropped()
+            << " dropped while display was busy)." << std::endl;
+    if (options.track) {
+        std::cout << "Tracking: " << tracker.images_tracked() << " frames were only searched around the glyphs' previous positions; "
+                << tracker.images_searched() << " were searched in full." << std::endl;
+    }
+    latency.print(std::cout);
+
+    return true;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _LIVE_H
+#define _LIVE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "page.h"
+#include "trace.h"
+
+// A hand-off between two threads that only ever holds the newest item: put()
+// never blocks, and replaces (and counts as dropped) any item that hasn't been
+// taken yet. This lets a slow consumer always work on the latest frame
+// instead of falling further and further behind the camera.
+template <typename T>
+class LatestSlot
+{
+private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::unique_ptr<T> item;
+    bool closed;
+    long dropped;
+
+public:
+    LatestSlot() : closed(false), dropped(0) {}
+
+    void put(std::unique_ptr<T> new_item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (item) {
+            dropped++;
+        }
+        item = std::move(new_item);
+        not_empty.notify_one();
+    }
+
+    // Take the item, waiting for one if `wait` is true. Returns false if
+    // there is none (when waiting: once the slot is closed and empty).
+    bool take(std::unique_ptr<T> &taken, bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait) {
+            not_empty.wait(lock, [this] { return item || closed; });
+        }
+        if (!item) {
+            return false;
+        }
+        taken = std::move(item);
+        return true;
+    }
+
+    // Signal that no more items will be put.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+    bool is_closed()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed && !item;
+    }
+
+    long number_dropped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped;
+    }
+};
+
+// Counts of how long frames took from capture to display, in milliseconds.
+class LatencyHistogram
+{
+private:
+    std::vector<double> samples;
+
+public:
+    void add(double milliseconds) { samples.push_back(milliseconds); }
+
+    // Print percentiles and a histogram of the latencies.
+    void print(std::ostream &out) const;
+};
+
+struct LiveOptions
+{
+    std::string video_path; // Read frames from this file; empty for the webcam.
+    bool headless; // Don't open any windows.
+    DetectionOptions detection;
+    RigSession *session; // NULL unless in fixed-rig mode.
+    bool track; // Follow the markers from frame to frame (see MarkerTracker).
+    int track_full_every; // With track, search in full at least this often.
+    Tracer *tracer; // NULL unless a timeline of the run is wanted.
+    bool verbose;
+};
+
+// Run the live calibration mode: capture frames from the webcam (or a video
+// file) on one thread, find the glyphs and render the pages on another, and
+// show the results on this one, which must be the main (UI) thread. Each
+// thread hands over only its newest result, so a slow step drops frames
+// rather than delaying everything after it. Stops when a key is pressed in
+// one of the windows or the video ends, then prints the latency histogram.
+// Returns false if the camera or video could not be opened.
+bool run_live(const std::vector<PageSpec> &pages, const LiveOptions &options);
+
+#endif
@@ -24,6 +24,7 @@
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc_c.h>
 
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -34,6 +35,11 @@
 
 #include "marker.h"
 #include "page.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "session.h"
+#include "stats.h"
+#include "live.h"
 
 /////////////////////////////////////////////
 
@@ -56,6 +62,14 @@ R"(voussoir.
       voussoir [--verbose] [--no-left-page] [--no-right-page] [-w <page_width_argument>] [-t <page_height_argument>] [-i <input_image>] [<output_image_one>] [<output_image_two>]
       
       voussoir [--verbose] [--no-left-page] [--no-right-page] [-w <page_width_argument>] [-t <page_height_argument>] [-d <dpi>] [--offset-left-page-left-side <offset_left_page_left_side>] [--offset-left-page-right-side <offset_left_page_right_side>] [--offset-left-page-top-side <offset_left_page_top_side>] [--offset-left-page-bottom-side <offset_left_page_bottom_side>] [--offset-right-page-left-side <offset_right_page_left_side>] [--offset-right-page-right-side <offset_right_page_right_side>] [--offset-right-page-top-side <offset_right_page_top_side>] [--offset-right-page-bottom-side <offset_right_page_bottom_side>] [-i <input_image>] [<output_image_one>] [<output_image_two>]
+      
+      voussoir [options] -i <input_image> [<output_image_one>] [<output_image_two>]
+      
+      voussoir [options] --batch=<input_spec> --output-dir=<output_dir>
+      
+      voussoir [options] --batch=<input_spec> --detect-only=<json_file>
+      
+      voussoir [options] (--live | --video=<video_file>)
 
     Options:
       -h --help     Show this screen.
@@ -70,11 +84,47 @@ R"(voussoir.
       
       -d --dpi=<dpi>  The DPI level at which to save the output images. [default: 600.0]
       
+      --fixed-rig  For rigs in which the camera and the glyphs stay in place from one image to the next (batch and webcam modes): remember where the glyphs were found, and for each new image only check that they're still there, skipping the full search unless they've moved.
+      --redetect-every=<redetect_every>  With --fixed-rig, also run the full glyph search at least once every this many images. 0 to only search again when the glyphs have moved. [default: 0]
+      --rig-tolerance=<rig_tolerance>  With --fixed-rig, how far (in pixels) a glyph corner may drift before the glyphs are considered to have moved. [default: 1.0]
+      
+      --preview-scale=<preview_scale>  Look for the glyphs on a grayscale copy of each input image decoded at 1/2, 1/4 or 1/8 of its size (which JPEG images can be decoded to much faster than to full size), and only decode the full-size color image if the glyphs needed are found. Blurred or empty images are then skipped quickly. 1 to always decode the full image. Defaults to 1, or to 2 with --detect-only.
+      
+      --detection-size=<detection_size>  Look for glyphs on a reduced-size copy of each input image whose longer side is at most this many pixels, then refine the glyph corners at full resolution. This speeds up detection considerably on high-megapixel images (e.g., try 2000). 0 to always look for glyphs at full resolution. [default: 0]
+      --analysis-threads=<analysis_threads>  The number of threads checking whether each glyph-shaped outline found in an image is a glyph. Only images with many such outlines (e.g., pages of printed tables or halftone pictures) use more than one; 0 for one per CPU core. With more than one, the glyph debugging window isn't shown. [default: 1]
+      --tile-memory=<megabytes>  Look for glyphs in very large input images (e.g., 100-megapixel flatbed or medium-format captures) tile by tile, keeping the working copies of the image within this many megabytes; with --analysis-threads, several tiles are searched at once, sharing the budget. Each thread needs at least 2 x (2 x tile overlap)^2 bytes (4 megabytes with the default overlap); fewer threads are used if the budget can't hold that many, and a budget below one thread's share is an error. 0 to always search the whole image at once. [default: 0]
+      --tile-overlap=<pixels>  How much neighboring tiles overlap. Must be larger than the largest glyph in the input images, plus 64 pixels. [default: 640]
+      
+      --trace=<trace_file>  Write a timeline of the run to this file, showing when each thread loaded, searched for glyphs in (including each candidate glyph it analyzed), de-keystoned and saved each image. Open it in chrome://tracing or https://ui.perfetto.dev to see where the time went.
+      
+      --live  Open the webcam for real-time glyph detection (see "Debugging mode" below). Needed only to give other options in this mode.
+      --video=<video_file>  Like --live, but read the frames from a video file instead of the webcam (e.g., to test a setup, or measure latency, without a camera).
+      --headless  In live mode, don't open any windows; only report the frame counts and latency when done.
+      
+      --track  In live and batch modes, follow the glyphs from one image to the next: look for each glyph only near where it was in the previous image (allowing for it moving), and search the whole image only if a glyph is lost. Much faster when the glyphs move only a little between images. In batch mode, use with --detect-threads 1, so that each image follows the one before it.
+      --track-full-every=<track_full_every>  With --track, search the whole image at least once every this many images anyway, so that glyphs that come into view are found. 0 to only search the whole image when a glyph is lost. [default: 10]
+      
+      --stats=<stats_file>  Write how long each stage of processing took (loading, glyph detection, de-keystoning, saving), and how many candidate glyphs each check rejected, to this file, as one line of JSON per input image.
+      
       -i --input-image=<input_image>  The input image.
       
       <output_image_one>  The output image. Needs to have an image-like file extension (e.g., ".jpg", ".JPG", ".png", ".tif", ".tiff").
       <output_image_two>  If relevant, the second output image (see <output_image_one> above).
       
+      -b --batch=<input_spec>  Process many spreads in one run of the program. <input_spec> can be a directory (every image in it is processed), a quoted glob pattern (e.g., "scans/*.jpg"), or a manifest file listing one image path per line.
+      -o --output-dir=<output_dir>  The directory in which batch mode saves its output images, named "<input_name>-left_page.<ext>" and "<input_name>-right_page.<ext>".
+      --detect-only=<json_file>  Batch mode: only look for the glyphs (e.g., to check a rig's setup on many test captures), and write what was found in each input image to this file, as one line of JSON per image, giving the ID, corners (in pixels) and confidence of each glyph. No pages are made. Each image is only decoded in grayscale, at the size given by --preview-scale (half size unless given; 1 for full size, which finds smaller glyphs but decodes more slowly), and the images are spread over all CPU cores.
+      
+      --decode-threads=<decode_threads>  Batch mode: the number of threads loading input images. [default: 1]
+      --detect-threads=<detect_threads>  Batch mode: the number of threads detecting glyphs. [default: 1]
+      --warp-threads=<warp_threads>  Batch mode: the number of threads de-keystoning and cropping pages. [default: 1]
+      --encode-threads=<encode_threads>  Batch mode: the number of threads saving output images. [default: 1]
+      --queue-depth=<queue_depth>  Batch mode: the number of spreads allowed to wait between two of the stages above. Higher values smooth out uneven stages, at the cost of memory. [default: 2]
+      --save-markers  Batch mode: also save where the glyphs were found in each input image, as "<input_name>.markers" in the output directory, so that its pages can be cut out again later with --render-only.
+      --render-only  Batch mode: cut out the pages of each input image using the glyphs saved for it by an earlier run with --save-markers (e.g., to try other offsets, page sizes or DPI), without looking for the glyphs again. Images that have changed since, or have no saved glyphs, are searched as usual.
+      --cache-dir=<cache_dir>  Batch mode: keep the pages made from each input image in this directory (as hard links, where it's on the same disk as the output directory), and when an image is met again with the same settings (e.g., when a folder is processed again after re-shooting a few spreads, or after a run was interrupted), put its pages back instead of making them again.
+      --cache-size=<megabytes>  With --cache-dir, the most disk space the cache may use; the spreads used longest ago are dropped from it first. [default: 10240]
+      
       --offset-left-page-left-side=<offset_left_page_left_side>  Page offset, in the same units as page height and width. [default: 0.00]
       --offset-left-page-right-side=<offset_left_page_right_side>  Page offset, in the same units as page height and width. [default: 0.00]
       --offset-left-page-top-side=<offset_left_page_top_side>  Page offset, in the same units as page height and width. [default: 0.00]
@@ -86,7 +136,7 @@ R"(voussoir.
       --offset-right-page-bottom-side=<offset_right_page_bottom_side>  Page offset, in the same units as page height and width. [default: 0.00]
       
     Debugging mode:
-      Running the program without any arguments will open a webcam window for real-time glyph detection (for calibration). If a webcam is found, this will cause a window to open, showing output from the webcam. When the four "left page" glyphs (i.e., glyphs 0, 1, 2, and 3) are detected by the webcam, a new window will open showing the de-keystoned image that the four glyphs surround. Similarly, when the four "right page" glyphs (i.e., glyphs 4, 5, 6, and 7) are detected by the webcam, an additional new window will open, showing the de-keystoned image for those four glyphs. Throughout this process, debugging text will be given in the terminal window, including which glyphs are detected.
+      Running the program without any arguments (and without --batch) will open a webcam window for real-time glyph detection (for calibration). If a webcam is found, this will cause a window to open, showing output from the webcam. When the four "left page" glyphs (i.e., glyphs 0, 1, 2, and 3) are detected by the webcam, a new window will open showing the de-keystoned image that the four glyphs surround. Similarly, when the four "right page" glyphs (i.e., glyphs 4, 5, 6, and 7) are detected by the webcam, an additional new window will open, showing the de-keystoned image for those four glyphs. Throughout this process, debugging text will be given in the terminal window, including which glyphs are detected. Frames are captured, searched and displayed on separate threads, so if searching a frame takes longer than capturing one, the frames in between are skipped rather than queued up, and what's displayed stays close to live. When a key is pressed in one of the windows, the program stops and reports how long frames took from capture to display.
       
     Placing markers:
       Within the docs directory, you'll find PDF and Adobe Illustrator / Inkscape versions of a series of 15 "glyphs," small images that each comprises a unique pattern of pixels in a 6x6 grid. You'll need to print and cut out the glyphs; at the moment, only glyphs 0-3 (left page) and 4-7 (right page) are needed. Tape or otherwise affix the glyphs in clockwise order around the perimeter of each book page (for example, if you're using a glass or acrylic platen to flatten the pages of a book, affix the glyphs in each corner of the platen: starting at the top left and moving clockwise to the center/spine of the book, place glyphs 0, 1, 2, and 3 around the left page, and (again from top left and moving clockwise) glyphs 4, 5, 6, and 7 on the right page. The program will, by default, crop to the inside vertical, outside horizontal edge of the glyphs it detects. This can be adjusted using the offset arguments defined above. The offset arguments can be positive or negative (e.g., setting --offset-left-page-left-side to -0.5 will move the crop line to the left 0.5 units).
@@ -98,33 +148,88 @@ R"(voussoir.
 // Define the program
 /////////////////////////////////////////////
 
-void process_image(IplImage *src_img,
-        std::map<int, CvPoint2D32f> &left_dst_markers,
-        LayoutInfo left_layout,
-        std::map<int, CvPoint2D32f> &right_dst_markers,
-        LayoutInfo right_layout)
+// Detect the glyphs in one two-page spread and save the requested pages (rendering them in parallel). Returns false if the input image could not be loaded.
+bool process_spread(const char *input_path,
+        const std::vector<PageSpec> &pages,
+        const std::vector<std::string> &output_paths,
+        int preview_scale,
+        const DetectionOptions &detection_options,
+        StatsWriter *stats_writer,
+        Tracer *tracer,
+        bool verbose)
 {
-	std::cout << "Since this is webcam mode, beginning to look for both left and right page markers (whether or not we have been told to ignore markers for left and/or right pages)..." << std::endl; // Remind the user that the --no-left-page and --no-right-page arguments don't make a difference in webcam mode.
-	
-    BookImage book_image(src_img);
-
-    {
-        IplImage *dst_img
-                = book_image.create_page_image(left_dst_markers, left_layout);
-        if (dst_img != NULL) {
-            cvShowImage("Left", dst_img);
-            cvReleaseImage(&dst_img);
+    // If stats or a trace are wanted, time each stage of processing this spread.
+    ImageStats spread_stats;
+    spread_stats.trace_to(tracer, input_path);
+    ImageStats *stats = (stats_writer != NULL || tracer != NULL) ? &spread_stats : NULL;
+    
+    // With a preview scale, look for the glyphs on a small grayscale version of the image first, and only load the full image if they're there.
+    IplImage *preview_img = NULL;
+    if (preview_scale > 1) {
+        StatsTimer timer(stats, STATS_LOAD);
+        preview_img = load_preview_image(input_path, preview_scale);
+        
+        if (preview_img == NULL) {
+            std::cerr << "Error: Failed to load the source image specified (" << input_path << ")." << std::endl;
+            return false;
         }
     }
-
-    {
-        IplImage *dst_img
-                = book_image.create_page_image(right_dst_markers, right_layout);
-        if (dst_img != NULL) {
-            cvShowImage("Right", dst_img);
-            cvReleaseImage(&dst_img);
+    
+    IplImage *src_img = NULL;
+    if (preview_img == NULL) {
+        StatsTimer timer(stats, STATS_LOAD);
+        src_img = cvLoadImage(input_path);
+        
+        if (src_img == NULL) {
+            std::cerr << "Error: Failed to load the source image specified (" << input_path << ")." << std::endl;
+            return false;
+        }
+    }
+    
+    BookImage book_img((preview_img != NULL) ? preview_img : src_img, detection_options, NULL, stats);
+    
+    if (preview_img != NULL) {
+        bool any_page_found = false;
+        for (size_t i = 0; i < pages.size(); i++) {
+            any_page_found = any_page_found || book_img.has_markers(pages[i].dst_markers);
+        }
+        
+        if (any_page_found == false) {
+            std::cout << "No page's glyphs were found in " << input_path << "; skipping it." << std::endl;
+            cvReleaseImage(&preview_img);
+            if (stats_writer != NULL) { stats_writer->write(input_path, spread_stats); }
+            return true;
+        }
+        
+        {
+            StatsTimer timer(stats, STATS_LOAD);
+            src_img = cvLoadImage(input_path);
+        }
+        
+        if (src_img == NULL) {
+            std::cerr << "Error: Failed to load the source image specified (" << input_path << ")." << std::endl;
+            cvReleaseImage(&preview_img);
+            return false;
+        }
+        
+        book_img.set_source_image(src_img);
+        cvReleaseImage(&preview_img);
+    }
+    
+    if(verbose == true){std::cout << "Processing " << pages.size() << " page(s)..." << std::endl;}
+    
+    std::vector<IplImage *> page_imgs = book_img.create_page_images(pages, output_paths);
+    for (size_t i = 0; i < page_imgs.size(); i++) {
+        if (page_imgs[i] != NULL) {
+            cvReleaseImage(&page_imgs[i]);
         }
     }
+    
+    cvReleaseImage(&src_img);
+    
+    if (stats_writer != NULL) { stats_writer->write(input_path, spread_stats); }
+    
+    return true;
 }
 
 float page_width;
@@ -132,6 +237,16 @@ float page_height;
 
 float dpi_for_output_images;
 
+int max_detection_size;
+int analysis_threads;
+int tile_memory_mb;
+int tile_overlap;
+int preview_scale;
+
+bool use_fixed_rig;
+int redetect_interval;
+float rig_tolerance;
+
 bool verbose;
 
 bool is_input_image_given;
@@ -143,6 +258,39 @@ const char* first_output_image;
 bool is_second_output_image_given;
 const char* second_output_image;
 
+bool is_stats_file_given;
+std::string stats_file;
+
+bool is_trace_file_given;
+std::string trace_file;
+
+bool use_tracking;
+int track_full_every;
+
+bool is_video_given;
+std::string video_file;
+bool headless;
+
+bool is_batch_given;
+std::string batch_input_spec;
+std::string batch_output_dir;
+
+bool is_detect_only_given;
+std::string detect_only_file;
+
+int decode_threads;
+int detect_threads;
+int warp_threads;
+int encode_threads;
+int queue_depth;
+
+bool save_markers;
+bool render_only;
+
+bool is_cache_dir_given;
+std::string cache_dir;
+int cache_size_mb;
+
 bool process_left_page;
 bool process_right_page;
 
@@ -198,6 +346,22 @@ int main(int argc, const char** argv)
     
     dpi_for_output_images = stof(args["--dpi"].asString());
     
+    max_detection_size = stoi(args["--detection-size"].asString());
+    analysis_threads = stoi(args["--analysis-threads"].asString());
+    tile_memory_mb = stoi(args["--tile-memory"].asString());
+    tile_overlap = stoi(args["--tile-overlap"].asString());
+    if(args["--preview-scale"]){
+        preview_scale = stoi(args["--preview-scale"].asString());
+    } else if(args["--detect-only"]){ // Detect-only runs never need the full-size image, so they look for the glyphs on a half-size decode unless told otherwise.
+        preview_scale = 2;
+    } else {
+        preview_scale = 1;
+    }
+    
+    use_fixed_rig = args["--fixed-rig"].asBool();
+    redetect_interval = stoi(args["--redetect-every"].asString());
+    rig_tolerance = stof(args["--rig-tolerance"].asString());
+    
     offset_left_page_left_side = stof(args["--offset-left-page-left-side"].asString());
     offset_left_page_right_side = stof(args["--offset-left-page-right-side"].asString());
     offset_left_page_top_side = stof(args["--offset-left-page-top-side"].asString());
@@ -207,8 +371,70 @@ int main(int argc, const char** argv)
     offset_right_page_top_side = stof(args["--offset-right-page-top-side"].asString());
     offset_right_page_bottom_side = stof(args["--offset-right-page-bottom-side"].asString());
     
+    decode_threads = stoi(args["--decode-threads"].asString());
+    detect_threads = stoi(args["--detect-threads"].asString());
+    warp_threads = stoi(args["--warp-threads"].asString());
+    encode_threads = stoi(args["--encode-threads"].asString());
+    queue_depth = stoi(args["--queue-depth"].asString());
+    
+    save_markers = args["--save-markers"].asBool();
+    render_only = args["--render-only"].asBool();
+    
+    if(args["--cache-dir"]){ // If a cache directory has been given, finished pages are kept there, and reused on later runs.
+        is_cache_dir_given = true;
+        cache_dir = args["--cache-dir"].asString();
+    } else {
+        is_cache_dir_given = false;
+    }
+    cache_size_mb = stoi(args["--cache-size"].asString());
+    
+    if(args["--stats"]){ // If a stats file has been given, timings and counters for each image are written to it.
+        is_stats_file_given = true;
+        stats_file = args["--stats"].asString();
+    } else {
+        is_stats_file_given = false;
+    }
+    
+    if(args["--video"]){ // If a video file has been given, it stands in for the webcam.
+        is_video_given = true;
+        video_file = args["--video"].asString();
+    } else {
+        is_video_given = false;
+    }
+    headless = args["--headless"].asBool();
+    
+    use_tracking = args["--track"].asBool();
+    track_full_every = stoi(args["--track-full-every"].asString());
     
-    if(args["--input-image"]){ // If a value has been set (i.e., is not null) is its default (just a space), treat it as not having been set.
+    if(args["--trace"]){ // If a trace file has been given, a timeline of the run is written to it.
+        is_trace_file_given = true;
+        trace_file = args["--trace"].asString();
+    } else {
+        is_trace_file_given = false;
+    }
+    
+    
+    if(args["--batch"]){ // If a batch input specification has been given, every spread it names is processed within this one run of the program.
+        std::cout << "Batch input was given. Processing every image it names..." << std::endl;
+        is_batch_given = true;
+        batch_input_spec = args["--batch"].asString();
+        if(args["--output-dir"]){
+            batch_output_dir = args["--output-dir"].asString();
+        }
+    } else {
+        is_batch_given = false;
+    }
+    
+    if(args["--detect-only"]){ // If a detect-only file has been given, the glyphs found in each batch input are written to it instead of cutting out pages.
+        is_detect_only_given = true;
+        detect_only_file = args["--detect-only"].asString();
+    } else {
+        is_detect_only_given = false;
+    }
+    
+    if(is_batch_given == true){
+        // The batch input replaces the single input image; there's nothing more to do here.
+    } else if(args["--input-image"]){ // If a value has been set (i.e., is not null) is its default (just a space), treat it as not having been set.
         std::cout << "Input image was given. Processing image..." << std::endl;
         is_input_image_given = true;
         input_image = args["--input-image"].asString().c_str();
@@ -279,68 +505,180 @@ int main(int argc, const char** argv)
     right_layout.page_right = page_width + offset_right_page_right_side;
     right_layout.page_bottom = page_height + offset_right_page_bottom_side;
     
-    // Process if an input image is supplied; otherwise, open a webcam for
-    // debugging.
-    if (is_input_image_given == true) {
+    // Define how glyphs are looked for:
+    DetectionOptions detection_options;
+    detection_options.max_detection_size = max_detection_size;
+    detection_options.analysis_threads = analysis_threads;
+    detection_options.tile_memory = static_cast<size_t>(tile_memory_mb) * 1024 * 1024;
+    detection_options.tile_overlap = tile_overlap;
+    if(detection_options.tile_memory > 0 && tile_overlap <= 2 * TILE_EDGE_MARGIN){ // Glyphs are only taken from well inside a tile, so a smaller overlap leaves strips between the tiles where they're never found.
+        std::cerr << "Error: --tile-overlap must be more than " << 2 * TILE_EDGE_MARGIN << " pixels (the size of the largest glyph plus " << 2 * TILE_EDGE_MARGIN << ")." << std::endl;
+        return 1;
+    }
+    if(detection_options.tile_memory > 0 && detection_options.tile_memory < minimum_tile_memory(tile_overlap)){ // A tile must be at least twice the overlap across, or glyphs would be missed.
+        size_t minimum_mb = (minimum_tile_memory(tile_overlap) + 1024 * 1024 - 1) / (1024 * 1024);
+        std::cerr << "Error: --tile-memory must be at least " << minimum_mb << " megabytes with a --tile-overlap of " << tile_overlap << " pixels." << std::endl;
+        return 1;
+    }
+    
+    // In fixed-rig mode, glyph positions are remembered from one image to the next.
+    RigSession rig_session(redetect_interval, rig_tolerance);
+    RigSession *session = (use_fixed_rig == true) ? &rig_session : NULL;
+    
+    // If asked to, record where the time goes for each image.
+    StatsWriter stats_file_writer;
+    StatsWriter *stats_writer = NULL;
+    if (is_stats_file_given == true) {
+        if (!stats_file_writer.open(stats_file)) {
+            std::cerr << "Error: Failed to create the stats file specified (" << stats_file << ")." << std::endl;
+            return 1;
+        }
+        stats_writer = &stats_file_writer;
+    }
+    
+    // If asked to, record a timeline of the run. (The file is finished when trace_file_writer goes out of scope.)
+    Tracer trace_file_writer;
+    Tracer *tracer = NULL;
+    if (is_trace_file_given == true) {
+        if (!trace_file_writer.open(trace_file)) {
+            std::cerr << "Error: Failed to create the trace file specified (" << trace_file << ")." << std::endl;
+            return 1;
+        }
+        tracer = &trace_file_writer;
+        tracer->name_thread("main");
+    }
+    
+    // Collect the pages to cut out of each spread:
+    std::vector<PageSpec> pages;
+    if (process_left_page == true) {
+        if(verbose == true){std::cout << "Left page will be processed." << std::endl;}
+        PageSpec left_page = {left_dst_markers, left_layout, "left_page"};
+        pages.push_back(left_page);
+    }
+    if (process_right_page == true) {
+        if(verbose == true){std::cout << "Right page will be processed." << std::endl;}
+        PageSpec right_page = {right_dst_markers, right_layout, "right_page"};
+        pages.push_back(right_page);
+    }
+    
+    // Stop looking for glyphs in an image once those of the pages to be processed have been found.
+    detection_options.required_markers = marker_mask(pages);
+    
+    // Process every spread in the batch, or the single input image if one is
+    // supplied; otherwise, open a webcam for debugging.
+    if (is_batch_given == true) {
+        std::vector<std::string> input_paths;
+        if (!collect_batch_inputs(batch_input_spec, input_paths)) {
+            std::cerr << "Error: Found no input images in the batch input specified (" << batch_input_spec << ")." << std::endl;
+            return 1;
+        }
         
-        IplImage *src_img = cvLoadImage(input_image);
+        if(verbose == true){std::cout << "Found " << input_paths.size() << " input images." << std::endl;}
         
-        if (src_img == NULL) {
-            std::cerr << "Error: Failed to load the source image specified." << std::endl;
-            return 1;
+        PipelineOptions pipeline_options;
+        pipeline_options.decode_threads = decode_threads;
+        pipeline_options.detect_threads = detect_threads;
+        pipeline_options.warp_threads = warp_threads;
+        pipeline_options.encode_threads = encode_threads;
+        pipeline_options.queue_depth = queue_depth;
+        pipeline_options.output_dir = batch_output_dir;
+        pipeline_options.preview_scale = preview_scale;
+        pipeline_options.detection = detection_options;
+        pipeline_options.session = session;
+        pipeline_options.track = use_tracking;
+        pipeline_options.track_full_every = track_full_every;
+        pipeline_options.stats_writer = stats_writer;
+        pipeline_options.tracer = tracer;
+        pipeline_options.save_markers = save_markers;
+        pipeline_options.render_only = render_only;
+        pipeline_options.cache = NULL;
+        pipeline_options.verbose = verbose;
+        
+        // If asked to, reuse the pages of spreads that were already processed with the same settings.
+        ResultCache result_cache(cache_dir, static_cast<uint64_t>(cache_size_mb) * 1024 * 1024);
+        if (is_cache_dir_given == true) {
+            if (result_cache.open()) {
+                pipeline_options.cache = &result_cache;
+            } else {
+                std::cerr << "Warning: Failed to open the cache directory specified (" << cache_dir << "); every spread will be processed." << std::endl;
+            }
         }
         
-        BookImage book_img(src_img);
+        // The marker debugging window can only be drawn from one thread, and there's no one to look at it in batch mode anyway.
+        show_marker_debug_window = false;
         
-        if (process_left_page == true) {
-        	if(verbose == true){std::cout << "Processing left page..." << std::endl;}
-        	
-	        IplImage *left_img
-	                = book_img.create_page_image(left_dst_markers, left_layout);
-	        
-	        if (left_img != NULL) {
-	            cvSaveImage(first_output_image, left_img);
-	            cvReleaseImage(&left_img);
-	        }
+        // Images that fail to load don't stop the rest of the batch (so that one bad capture doesn't stop a whole book); they're reported at the end instead.
+        int number_of_failures;
+        if (is_detect_only_given == true) {
+            std::ofstream detect_only_records(detect_only_file.c_str());
+            if (!detect_only_records) {
+                std::cerr << "Error: Failed to create the detect-only file specified (" << detect_only_file << ")." << std::endl;
+                return 1;
+            }
+            pipeline_options.detect_threads = 0; // One per CPU core.
+            number_of_failures = run_detect_only(input_paths, pipeline_options, detect_only_records);
+        } else {
+            number_of_failures = run_pipeline(input_paths, pages, pipeline_options);
         }
         
+        if(verbose == true && use_fixed_rig == true){std::cout << "Fixed-rig mode: " << rig_session.images_verified() << " images reused the remembered glyph positions; " << rig_session.images_detected() << " needed a full search." << std::endl;}
+        
+        if (number_of_failures > 0) {
+            std::cerr << "Error: " << number_of_failures << " of " << input_paths.size() << " input images could not be loaded." << std::endl;
+            return 1;
+        }
+    } else if (is_input_image_given == true) {
+        // The marker debugging window can only be drawn from one thread, so it's only shown when the glyphs (or tiles) are searched on one.
+        if(analysis_threads != 1){ show_marker_debug_window = false; }
+        
+        // The left page (if processed) goes to the first output image, and the right page to the second.
+        std::vector<std::string> output_paths;
+        if (process_left_page == true) {
+            output_paths.push_back(is_first_output_image_given ? first_output_image : "");
+        }
         if (process_right_page == true) {
-        	if(verbose == true){std::cout << "Processing right page..." << std::endl;}
-        	
-	        IplImage *right_img
-	                = book_img.create_page_image(right_dst_markers, right_layout);
-	        if (right_img != NULL) {
-	            cvSaveImage(second_output_image, right_img);
-	            cvReleaseImage(&right_img);
-	        }
-	    }
-	    
-        cvReleaseImage(&src_img);
+            output_paths.push_back(is_second_output_image_given ? second_output_image : "");
+        }
+        
+        if (!process_spread(input_image, pages, output_paths,
+                preview_scale, detection_options,
+                stats_writer, tracer, verbose)) {
+            return 1;
+        }
     } else { // Open debugging windows
-        // Create windows.
-        cvNamedWindow("Source", 0);
-        cvResizeWindow("Source", 480, 640);
-
+        std::cout << "Since this is webcam mode, beginning to look for both left and right page markers (whether or not we have been told to ignore markers for left and/or right pages)..." << std::endl; // Remind the user that the --no-left-page and --no-right-page arguments don't make a difference in webcam mode.
+        
         left_layout.dpi = 100;
         right_layout.dpi = 100;
-
-        // Open webcam.
-        CvCapture* capture = cvCreateCameraCapture(0);
-        if (!capture) {
-            std::cerr << "Failed to load the camera device." << std::endl;
-            return 1;
-        }
-        const double scale = 1.0;
-        cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_WIDTH, 1600 * scale);
-        cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_HEIGHT, 1200 * scale);
         
-        // Process the pages in real-time, displaying the output.
-        while (cvWaitKey(10) < 0) {
-            IplImage *src_img = cvQueryFrame(capture);
-            cvShowImage("Source", src_img);
-            process_image(src_img,
-                    left_dst_markers, left_layout,
-                    right_dst_markers, right_layout);
+        std::vector<PageSpec> live_pages(2);
+        live_pages[0].dst_markers = left_dst_markers;
+        live_pages[0].layout = left_layout;
+        live_pages[1].dst_markers = right_dst_markers;
+        live_pages[1].layout = right_layout;
+        
+        LiveOptions live_options;
+        live_options.video_path = is_video_given ? video_file : "";
+        live_options.headless = headless;
+        live_options.detection = detection_options;
+        live_options.detection.required_markers = marker_mask(live_pages);
+        live_options.session = session;
+        live_options.track = use_tracking;
+        live_options.track_full_every = track_full_every;
+        live_options.tracer = tracer;
+        live_options.verbose = verbose;
+        
+        // Glyphs are found on a worker thread, which can't draw the marker debugging window.
+        show_marker_debug_window = false;
+        
+        // Capture, process and display frames on separate threads until a key is pressed (or the video ends).
+        if (!run_live(live_pages, live_options)) {
+            if (is_video_given == true) {
+                std::cerr << "Failed to load the video file (" << video_file << ")." << std::endl;
+            } else {
+                std::cerr << "Failed to load the camera device." << std::endl;
+            }
+            return 1;
         }
     }
 
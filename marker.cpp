@@ -15,189 +15,333 @@
  */
 
 #include "marker.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
+bool show_marker_debug_window = true;
 
-int decode_marker(CvMat *mark_mat, marker_rotation_t &rotation)
+
+/*
+An explanation of the packed marker representation used below, throughout this file:
+
+Each glyph is a 6x6 grid of cells (the outermost ring of cells is a black border, with a 4x4 matrix in the center showing the glyph's unique mark). The grid is packed into the lowest 36 bits of a 64-bit integer, row by row from the top left: cell (i,j) -- i counting rows from the top and j counting columns from the left, both starting at 0 -- is bit i*6+j. A bit is set (1) when its cell is black.
+
+Decoding a glyph then needs only a few mask comparisons and a single lookup in a table that is generated by the compiler, rather than 36 separate matrix reads and a branch per rotation.
+*/
+
+// The bit for cell (i,j).
+static constexpr uint64_t cell_bit(int i, int j)
 {
-	/*
-	An explanation of cvmGet(mark_mat, i, j) below, throughout this file:
-	
-	mark_mat is the 6x6 matrix of pixels for each glyph. Some are black ('< 0.5' in the code below), and some are white ('> 0.5' in the code below).
-	
-	Position i,j (e.g., '2' and '3' in 'cvmGet(mark_mat, 2, 3)') represents a Y-coordinate (counting from top) and an X-coordinate (counting from left). The glyphs are each a 6x6 grid/matrix (two outer rows, with a 4x4 matrix in the center showing the glyph's unique mark). Thus, position (1,1) = top left of outer border, (1,6) = top right of outer border, etc.
-	*/
-	
-    // Make sure that the outermost cells are black (< 0.5 = black, > 0.5 = white).
-    // (The glyphs' outside edges are a 6x1 matrix, so 6x6 coordinates are available overall. This iterates over the perimeter.)
-    for (int i = 0; i < 6; i++) {
-        if (cvmGet(mark_mat, i, 0) > 0.5
-                    || cvmGet(mark_mat, i, 5) > 0.5
-                    || cvmGet(mark_mat, 0, i) > 0.5
-                    || cvmGet(mark_mat, 5, i) > 0.5) {
-            return -1;
-        }
-    }
+    return uint64_t(1) << (i * 6 + j);
+}
 
-    // Make sure that the next cells of the outermost cells are white.
-    // This skips all corners (1,1, 1,4, 4,4, and 4,1 (listing them clockwise), since they'll be checked below for orientation.
-    if (cvmGet(mark_mat, 2, 1) < 0.5
-                || cvmGet(mark_mat, 3, 1) < 0.5
-                || cvmGet(mark_mat, 1, 2) < 0.5
-                || cvmGet(mark_mat, 1, 3) < 0.5
-                || cvmGet(mark_mat, 2, 4) < 0.5
-                || cvmGet(mark_mat, 3, 4) < 0.5
-                || cvmGet(mark_mat, 4, 2) < 0.5
-                || cvmGet(mark_mat, 4, 3) < 0.5) {
-        return -1;
-    }
+// The outermost cells (which must all be black).
+static constexpr uint64_t border_mask(int k = 0)
+{
+    return k == 6 ? 0
+            : (cell_bit(0, k) | cell_bit(5, k) | cell_bit(k, 0) | cell_bit(k, 5))
+                | border_mask(k + 1);
+}
 
-    // Make sure that the number of corner markers is exactly one. Also
-    // detect the orientation.
-    int numberOfCornerMarkers = 0;
-    if (cvmGet(mark_mat, 1, 1) < 0.5) {
-        numberOfCornerMarkers++; // Used below to check that at least one of these conditions (and only one, lest the number be greater than 1) has been met.
-        rotation = MARKER_ROT_0_DEG;
-    }
-    if (cvmGet(mark_mat, 1, 4) < 0.5) {
-        numberOfCornerMarkers++;
-        rotation = MARKER_ROT_90_DEG;
-    }
-    if (cvmGet(mark_mat, 4, 4) < 0.5) {
-        numberOfCornerMarkers++;
-        rotation = MARKER_ROT_180_DEG;
-    }
-    if (cvmGet(mark_mat, 4, 1) < 0.5) {
-        numberOfCornerMarkers++;
-        rotation = MARKER_ROT_270_DEG;
-    }
-    if (numberOfCornerMarkers != 1) {
+// The cells next to the outermost cells, skipping the four corners of the
+// inner 4x4 matrix (which must all be white).
+static constexpr uint64_t white_ring_mask()
+{
+    return cell_bit(2, 1) | cell_bit(3, 1) | cell_bit(1, 2) | cell_bit(1, 3)
+            | cell_bit(2, 4) | cell_bit(3, 4) | cell_bit(4, 2) | cell_bit(4, 3);
+}
+
+static constexpr int bit_at(uint64_t bits, int i, int j)
+{
+    return static_cast<int>((bits >> (i * 6 + j)) & 1);
+}
+
+// Gather the eight cells that identify the glyph into one byte, the "lookup
+// key": the upper four bits are the corners of the inner 4x4 matrix (exactly
+// one of which is black, marking the glyph's orientation), and the lower four
+// bits are its central 2x2 cells, read as they appear in the image.
+static inline int lookup_key(uint64_t cells)
+{
+    return (bit_at(cells, 1, 1) << 4)
+            | (bit_at(cells, 1, 4) << 5)
+            | (bit_at(cells, 4, 4) << 6)
+            | (bit_at(cells, 4, 1) << 7)
+            | (bit_at(cells, 2, 2) << 3)
+            | (bit_at(cells, 2, 3) << 2)
+            | (bit_at(cells, 3, 2) << 1)
+            | (bit_at(cells, 3, 3) << 0);
+}
+
+// The glyph's orientation from the corner bits of a lookup key, or -1 unless
+// exactly one corner is black.
+static constexpr int key_rotation(int corners)
+{
+    return corners == 1 ? MARKER_ROT_0_DEG
+            : corners == 2 ? MARKER_ROT_90_DEG
+            : corners == 4 ? MARKER_ROT_180_DEG
+            : corners == 8 ? MARKER_ROT_270_DEG
+            : -1;
+}
+
+/*
+Un-rotate the central 2x2 cells into the glyph's own orientation.
+
+Within each rotation, the four central cells are weighted by a power of two (8, 4, 2, and 1; i.e., bitshifts of 3, 2, 1, and 0), starting from the cell nearest the rotation dot and moving across the glyph as it would read when upright. For each rotation, the table below gives the bitshift of the image's (2,2), (2,3), (3,2), and (3,3) cells (if you draw a 2x2 matrix and write the bitshift values on it for each of the four rotation cases, you'll see that they all follow the same (rotated) pattern). The results are additive: for example, the glyph whose code is 13 has the cells with bitshifts 3, 2, and 0 black, (1*2^3) + (1*2^2) + 0 + (1*2^0) = 13.
+*/
+static constexpr int rotated_code(int rotation, int image_bits)
+{
+    return rotation == MARKER_ROT_0_DEG
+            ? (((image_bits >> 3) & 1) << 3) | (((image_bits >> 2) & 1) << 2)
+                | (((image_bits >> 1) & 1) << 1) | (((image_bits >> 0) & 1) << 0)
+        : rotation == MARKER_ROT_90_DEG
+            ? (((image_bits >> 3) & 1) << 1) | (((image_bits >> 2) & 1) << 3)
+                | (((image_bits >> 1) & 1) << 0) | (((image_bits >> 0) & 1) << 2)
+        : rotation == MARKER_ROT_180_DEG
+            ? (((image_bits >> 3) & 1) << 0) | (((image_bits >> 2) & 1) << 1)
+                | (((image_bits >> 1) & 1) << 2) | (((image_bits >> 0) & 1) << 3)
+        : (((image_bits >> 3) & 1) << 2) | (((image_bits >> 2) & 1) << 0)
+                | (((image_bits >> 1) & 1) << 3) | (((image_bits >> 0) & 1) << 1);
+}
+
+// Map each (un-rotated) code to the glyph's ID, as printed in the markers
+// PDF. The 13th element in this (0-indexed) table is 5, for example.
+static constexpr unsigned char id_table[] = {
+    8, 2, 4, 15, 6, 13, 11, 1,
+    0, 10, 12, 7, 14, 5, 3, 9
+};
+
+// One entry of the lookup table: the rotation in the upper nibble and the
+// glyph ID in the lower nibble, or -1 for an invalid key.
+static constexpr int lookup_entry(int key)
+{
+    return key_rotation(key >> 4) < 0 ? -1
+            : (key_rotation(key >> 4) << 4)
+                | id_table[rotated_code(key_rotation(key >> 4), key & 0xf)];
+}
+
+// Generate all 256 entries of the lookup table at compile time.
+template <int... Keys>
+struct IndexList {};
+
+template <int N, int... Keys>
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, Keys...> {};
+
+template <int... Keys>
+struct MakeIndexList<0, Keys...>
+{
+    typedef IndexList<Keys...> type;
+};
+
+template <typename List>
+struct LookupTable;
+
+template <int... Keys>
+struct LookupTable<IndexList<Keys...> >
+{
+    static constexpr signed char entries[sizeof...(Keys)] = {
+        static_cast<signed char>(lookup_entry(Keys))...
+    };
+};
+
+template <int... Keys>
+constexpr signed char LookupTable<IndexList<Keys...> >::entries[sizeof...(Keys)];
+
+typedef LookupTable<MakeIndexList<256>::type> MarkerLookupTable;
+
+static_assert(MarkerLookupTable::entries[0x10 | 13] == 5,
+        "code 13 in the upright orientation should decode as glyph 5");
+static_assert(MarkerLookupTable::entries[0x30] == -1,
+        "two orientation dots should never decode");
+
+int decode_marker(uint64_t cells, marker_rotation_t &rotation)
+{
+    // Make sure that the outermost cells are black, and that the next cells
+    // in from them are white.
+    if ((cells & border_mask()) != border_mask()
+            || (cells & white_ring_mask()) != 0) {
         return -1;
     }
 
-    /*
-	An explanation of the marker identification process below:
-
-	'<<' is a bitshift operator (i.e., go from the binary number 001 to the binary number 010 (i.e., 2)). In effect, it multiplies any number by 2 to the power of the bitshift (e.g., 1 << 8 is equivalent to 1*2^8).
-
-	Each case statement (i.e., each rotation) contains the same four 'if' statements (rotated by 90 degrees more than the last case for each rotation -- if you draw a 4x4 matrix and write the bitshift values (0, 1, 2, and 3) on the coordinates for each of the four rotation cases and compare them to each other, you'll see that they all follow the same (rotated) pattern).
-
-	Within each rotation case, each of the if statements looks at a particular coordinate of the matrix and returns true if that coordinate is black rather than white, and makes a bitshift (starting at 0, following the 'int id = 0' line below).
-
-	The bitshift results are additive (not multiplicative) over the if statements: '|' is the bitwise OR operator, meaning that it considers all bits in the list that are true. Thus, for the '5' glyph, which meets the first, second, and fourth conditions (since those three pixels are black), the math would be (1*2^3) + 1*2^2 + 0 + 1*2^0 = 13 (showing the math for the first, second, third, and fourth condition, respectively). The 13th element in the ID array (counting from 0) is 5.
-    */
-
-    int id = 0;
-    switch (rotation) {
-    case MARKER_ROT_0_DEG:
-        id = ((cvmGet(mark_mat, 2, 2) < 0.5) << 3)
-                | ((cvmGet(mark_mat, 2, 3) < 0.5) << 2)
-                | ((cvmGet(mark_mat, 3, 2) < 0.5) << 1)
-                | ((cvmGet(mark_mat, 3, 3) < 0.5) << 0);
-        break;
-    case MARKER_ROT_90_DEG:
-        id = ((cvmGet(mark_mat, 2, 2) < 0.5) << 1)
-                | ((cvmGet(mark_mat, 2, 3) < 0.5) << 3)
-                | ((cvmGet(mark_mat, 3, 2) < 0.5) << 0)
-                | ((cvmGet(mark_mat, 3, 3) < 0.5) << 2);
-        break;
-    case MARKER_ROT_180_DEG:
-        id = ((cvmGet(mark_mat, 2, 2) < 0.5) << 0)
-                | ((cvmGet(mark_mat, 2, 3) < 0.5) << 1)
-                | ((cvmGet(mark_mat, 3, 2) < 0.5) << 2)
-                | ((cvmGet(mark_mat, 3, 3) < 0.5) << 3);
-        break;
-    case MARKER_ROT_270_DEG:
-        id = ((cvmGet(mark_mat, 2, 2) < 0.5) << 2)
-                | ((cvmGet(mark_mat, 2, 3) < 0.5) << 0)
-                | ((cvmGet(mark_mat, 3, 2) < 0.5) << 3)
-                | ((cvmGet(mark_mat, 3, 3) < 0.5) << 1);
-        break;
+    // Make sure that the number of corner markers is exactly one, detect the
+    // orientation, and determine the ID, all in one lookup.
+    int entry = MarkerLookupTable::entries[lookup_key(cells)];
+    if (entry < 0) {
+        return -1;
     }
+    rotation = static_cast<marker_rotation_t>(entry >> 4);
+    int id = entry & 0xf;
 
-    // Now determine the id using a (0-indexed) table.
-    static const unsigned char id_table[] = {
-        8, 2, 4, 15, 6, 13, 11, 1,
-        0, 10, 12, 7, 14, 5, 3, 9
-    };
-    id = id_table[id];
-    
     // Uncomment the line below for debugging text.
     //std::cout << "Detected marker ID is " << id << ".\n";
-    
+
     return id;
 }
 
-int analyze_marker(const IplImage *src_img, CvSeq *poly, CvPoint2D32f *points)
+uint64_t encode_marker(int id)
+{
+    // Every glyph has a black border, a white ring inside it, and its
+    // rotation dot at (1,1) when upright; only the central 2x2 cells differ.
+    // Try each of their 16 patterns until one decodes as the requested ID.
+    for (int image_bits = 0; image_bits < 16; image_bits++) {
+        uint64_t cells = border_mask() | cell_bit(1, 1)
+                | (((image_bits >> 3) & 1) ? cell_bit(2, 2) : 0)
+                | (((image_bits >> 2) & 1) ? cell_bit(2, 3) : 0)
+                | (((image_bits >> 1) & 1) ? cell_bit(3, 2) : 0)
+                | (((image_bits >> 0) & 1) ? cell_bit(3, 3) : 0);
+        marker_rotation_t rotation;
+        if (decode_marker(cells, rotation) == id) {
+            return cells;
+        }
+    }
+    return 0;
+}
+
+// Sample a single-channel 8-bit image at a sub-pixel position, using bilinear
+// interpolation. Positions outside the image are clamped to its edge.
+static double sample_bilinear(const IplImage *img, double x, double y)
 {
-    // Make sure the shape is square and convex.
-    if (poly->total != 4
-            || !cvCheckContourConvexity(poly)
-            || cvContourArea(poly) < 360.0) {
+    x = std::min(std::max(x, 0.0), img->width - 1.0);
+    y = std::min(std::max(y, 0.0), img->height - 1.0);
+    int x0 = static_cast<int>(x);
+    int y0 = static_cast<int>(y);
+    int x1 = std::min(x0 + 1, img->width - 1);
+    int y1 = std::min(y0 + 1, img->height - 1);
+    double fx = x - x0;
+    double fy = y - y0;
+
+    const uchar *row0 = reinterpret_cast<const uchar *>(
+            img->imageData + y0 * img->widthStep);
+    const uchar *row1 = reinterpret_cast<const uchar *>(
+            img->imageData + y1 * img->widthStep);
+    double top = row0[x0] + (row0[x1] - row0[x0]) * fx;
+    double bottom = row1[x0] + (row1[x1] - row1[x0]) * fx;
+    return top + (bottom - top) * fy;
+}
+
+static int read_marker(const IplImage *src_img, CvPoint2D32f *points,
+        double *confidence);
+
+int analyze_marker(const IplImage *src_img, CvSeq *poly, CvPoint2D32f *points,
+        int scale, ImageStats *stats, double *confidence)
+{
+    // Make sure the shape is square and convex, and large enough to read.
+    if (poly->total != 4) {
+        if (stats != NULL) { stats->add_count(STATS_REJECTED_POINTS); }
+        return -1;
+    }
+    if (!cvCheckContourConvexity(poly)) {
+        if (stats != NULL) { stats->add_count(STATS_REJECTED_CONVEXITY); }
+        return -1;
+    }
+    if (cvContourArea(poly) * scale * scale < 360.0) {
+        if (stats != NULL) { stats->add_count(STATS_REJECTED_AREA); }
         return -1;
     }
 
+    // (Pixel centers of a downscaled image sit at (x + 0.5) * scale - 0.5 in
+    // the full-resolution one.)
     for (int i = 0; i < 4; i++) {
-        points[i] = cvPointTo32f(*CV_GET_SEQ_ELEM(CvPoint, poly, i));
+        CvPoint corner = *CV_GET_SEQ_ELEM(CvPoint, poly, i);
+        points[i] = cvPoint2D32f((corner.x + 0.5) * scale - 0.5,
+                (corner.y + 0.5) * scale - 0.5);
+    }
+
+    refine_marker_corners(src_img, points, scale);
+
+    int marker_id = read_marker(src_img, points, confidence);
+    if (stats != NULL) {
+        stats->add_count(marker_id != -1 ? STATS_MARKERS_FOUND
+                : STATS_REJECTED_DECODE);
+    }
+    return marker_id;
+}
+
+int analyze_marker_corners(const IplImage *src_img, CvPoint2D32f *points)
+{
+    refine_marker_corners(src_img, points, 1);
+
+    return read_marker(src_img, points, NULL);
+}
+
+void refine_marker_corners(const IplImage *src_img, CvPoint2D32f *points,
+        int scale)
+{
+    // Corners found on a downscaled image can be a few pixels off at full
+    // resolution: pull them in with a search window wide enough to cover
+    // that first, so the final refinement below starts from the same place
+    // full-resolution detection would.
+    if (scale > 1) {
+        cvFindCornerSubPix(src_img, points, 4, cvSize(2 * scale, 2 * scale),
+                cvSize(-1, -1),
+                cvTermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03));
     }
 
     // Refine to sub-pixel accuracy.
     cvFindCornerSubPix(src_img, points, 4, cvSize(3, 3), cvSize(-1, -1),
              cvTermCriteria (CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03));
+}
 
-    double a[] = {
-        points[0].x, points[0].y,
-        points[1].x, points[1].y,
-        points[2].x, points[2].y,
-        points[3].x, points[3].y
-    };
-    CvMat src_points = cvMat(poly->total, 2, CV_64FC1, a);
-
+// Read and decode the marker whose (refined) corners are in points, and
+// reorder them to start from the corner with the rotation dot.
+static int read_marker(const IplImage *src_img, CvPoint2D32f *points,
+        double *confidence)
+{
+    // The marker is read on an 18x18 grid: 3x3 samples for each of its 6x6
+    // cells. Rather than warping the marker into an image of its own, map
+    // each sample position through the marker's homography and read it
+    // straight from the source image; this needs no allocation at all.
     static const int MARK_WIDTH = 6*3;
     static const int MARK_HEIGHT = 6*3;
-    static const int MARK_TEMP_WIDTH = MARK_WIDTH * 10;
-    static const int MARK_TEMP_HEIGHT = MARK_HEIGHT * 10;
-    IplImage *mark_temp_img = cvCreateImage(
-            cvSize(MARK_TEMP_WIDTH, MARK_TEMP_HEIGHT), IPL_DEPTH_8U, 1);
-    double b[] = {
-        0, 0,
-        0, MARK_TEMP_HEIGHT,
-        MARK_TEMP_WIDTH, MARK_TEMP_HEIGHT,
-        MARK_TEMP_WIDTH, 0,
+    const CvPoint2D32f mark_points[] = {
+        cvPoint2D32f(0, 0),
+        cvPoint2D32f(0, MARK_HEIGHT),
+        cvPoint2D32f(MARK_WIDTH, MARK_HEIGHT),
+        cvPoint2D32f(MARK_WIDTH, 0)
     };
-    CvMat mark_points = cvMat(poly->total, 2, CV_64FC1, b);
-
-    // Compute homography matrix.
-    CvMat *h = cvCreateMat(3, 3, CV_64FC1);
-    cvFindHomography(&src_points, &mark_points, h);
-
-    // Transform perspective.
-    cvWarpPerspective(src_img, mark_temp_img, h);
-
-    IplImage *mark_img = cvCreateImage(
-            cvSize(MARK_WIDTH, MARK_HEIGHT), IPL_DEPTH_8U, 1);
-    cvResize(mark_temp_img, mark_img, CV_INTER_AREA);
-    int threshold = cvAvg(mark_img).val[0];
-    cvThreshold(mark_img, mark_img, threshold, 255, CV_THRESH_BINARY);
-    for (int i = 0; i < MARK_WIDTH; i++) {
-        for (int j = 0; j < MARK_HEIGHT; j++) {
-            if ((i % 3) != 1 || (j % 3) != 1) {
-                cvSetReal2D(mark_img, i, j, threshold);
-            }
+
+    // Compute homography matrix (from marker grid to source image).
+    double h[9];
+    CvMat h_mat = cvMat(3, 3, CV_64FC1, h);
+    cvGetPerspectiveTransform(mark_points, points, &h_mat);
+
+    // Sample the center of every grid square.
+    double samples[MARK_HEIGHT][MARK_WIDTH];
+    double sum = 0.0;
+    for (int i = 0; i < MARK_HEIGHT; i++) {
+        for (int j = 0; j < MARK_WIDTH; j++) {
+            double u = j + 0.5;
+            double v = i + 0.5;
+            double w = h[6] * u + h[7] * v + h[8];
+            double x = (h[0] * u + h[1] * v + h[2]) / w;
+            double y = (h[3] * u + h[4] * v + h[5]) / w;
+            samples[i][j] = sample_bilinear(src_img, x, y);
+            sum += samples[i][j];
         }
     }
 
-    // Create marker matrix.
-    CvMat *mark_mat = cvCreateMat(6, 6, CV_64FC1);
+    // Threshold at the marker's average brightness, and take the middle
+    // sample of each cell as that cell's value (see decode_marker for how
+    // the cells are packed).
+    int threshold = static_cast<int>(sum / (MARK_WIDTH * MARK_HEIGHT));
+    uint64_t cells = 0;
+    double margin = 255.0;
     for (int i = 0; i < 6; i++) {
         for (int j = 0; j < 6; j++) {
-            cvmSet(mark_mat, i, j, (cvGetReal2D(mark_img, i*3+1, j*3+1) > 128));
+            if (!(samples[i*3+1][j*3+1] > threshold)) {
+                cells |= uint64_t(1) << (i * 6 + j);
+            }
+            margin = std::min(margin,
+                    std::fabs(samples[i*3+1][j*3+1] - threshold));
         }
     }
+    if (confidence != NULL) {
+        *confidence = margin;
+    }
 
     // Decode the marker ID.
-    marker_rotation_t rotation;
-    int marker_id = decode_marker(mark_mat, rotation);
+    marker_rotation_t rotation = MARKER_ROT_0_DEG;
+    int marker_id = decode_marker(cells, rotation);
 
     // Based on rotation, correct the points array so that it starts from
     // the corner with the rotation dot.
@@ -209,19 +353,23 @@ int analyze_marker(const IplImage *src_img, CvSeq *poly, CvPoint2D32f *points)
         points[i] = temp[(i + rotation) % 4];
     }
 
-    // Show decoded marker image for debugging.
+    // Show decoded marker image for debugging. (Only this needs an image.)
     //*
-    if (marker_id != -1) {
-        cvResize(mark_img, mark_temp_img, CV_INTER_AREA);
-        cvShowImage("Window", mark_temp_img);
+    if (marker_id != -1 && show_marker_debug_window) {
+        IplImage *mark_img = cvCreateImage(
+                cvSize(MARK_WIDTH * 10, MARK_HEIGHT * 10), IPL_DEPTH_8U, 1);
+        for (int i = 0; i < MARK_HEIGHT * 10; i++) {
+            for (int j = 0; j < MARK_WIDTH * 10; j++) {
+                bool cell_center = ((i / 10) % 3) == 1 && ((j / 10) % 3) == 1;
+                bool white = samples[i / 10][j / 10] > threshold;
+                cvSetReal2D(mark_img, i, j,
+                        cell_center ? (white ? 255 : 0) : threshold);
+            }
+        }
+        cvShowImage("Window", mark_img);
+        cvReleaseImage(&mark_img);
     }
     //*/
 
-    // Clean up.
-    cvReleaseMat(&h);
-    cvReleaseMat(&mark_mat);
-    cvReleaseImage(&mark_img);
-    cvReleaseImage(&mark_temp_img);
-
     return marker_id;
 }
@@ -23,6 +23,13 @@
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc_c.h>
 
+#include <stdint.h>
+
+#include "stats.h"
+
+// The number of distinct glyphs (IDs 0 to 15).
+static const int NUMBER_OF_MARKER_IDS = 16;
+
 // Create a new type, marker_rotation_t. We'll create a variable of this type and call it "rotation" in the marker.cpp file.
 typedef enum {
     MARKER_ROT_0_DEG,
@@ -31,6 +38,48 @@ typedef enum {
     MARKER_ROT_90_DEG,
 } marker_rotation_t;
 
-int analyze_marker(const IplImage *src_img, CvSeq *poly, CvPoint2D32f *points);
+// Decode a glyph's 6x6 grid of cells, packed one bit per cell (cell (i,j) at
+// bit i*6+j, counting rows and columns from the top left; set when black).
+// Returns the glyph's ID and sets its rotation, or returns -1 if the cells
+// aren't a valid glyph.
+int decode_marker(uint64_t cells, marker_rotation_t &rotation);
+
+// The cells of glyph `id` (0 to 15) in its upright orientation, packed as for
+// decode_marker; the inverse of decode_marker. Returns 0 for an invalid ID.
+uint64_t encode_marker(int id);
+
+// Whether analyze_marker shows each decoded marker in a window, for debugging.
+// (On by default; this is only safe when markers are analyzed on one thread.)
+extern bool show_marker_debug_window;
+
+// Check whether a contour polygon is a marker, and decode it. src_img is the
+// full-resolution grayscale image; if poly was found on a copy of it that was
+// downscaled by `scale`, its corners are scaled back up and refined first.
+// The sub-pixel corners are written to points, starting from the corner with
+// the rotation dot. Returns the marker ID, or -1 if poly isn't a marker. If
+// stats is given, the reason poly was rejected (or that it was a marker) is
+// counted there. If confidence is given, it's set to how clearly the marker
+// was read: how far (in gray levels) its least clear cell was from the
+// threshold between black and white.
+int analyze_marker(const IplImage *src_img, CvSeq *poly, CvPoint2D32f *points,
+        int scale = 1, ImageStats *stats = NULL, double *confidence = NULL);
+
+// Like analyze_marker, but for a marker whose four corners are already
+// approximately known (e.g., from an earlier image of the same scene): the
+// corners in points are refined in place and the marker is decoded.
+int analyze_marker_corners(const IplImage *src_img, CvPoint2D32f *points);
+
+// Refine the four approximate corners of a marker to sub-pixel accuracy on
+// src_img. If the corners were found on a copy of it downscaled by `scale`,
+// they are first pulled in with a correspondingly wider search window.
+void refine_marker_corners(const IplImage *src_img, CvPoint2D32f *points,
+        int scale);
+
+// The four sub-pixel corners of a detected marker, starting from the corner
+// with the rotation dot.
+struct MarkerCorners
+{
+    CvPoint2D32f points[4];
+};
 
 #endif
@@ -15,144 +15,1049 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 //#include <cstring>
 //#include <stdio.h>
 
+#include <opencv2/imgcodecs.hpp>
+
 #include "page.h"
 #include "marker.h"
+#include "session.h"
+#include "tracker.h"
+#include "parallel.h"
+#include "threshold.h"
+#include "warp.h"
+
+// A header for the rect part of an 8-bit image, sharing its pixels.
+static IplImage image_region(const IplImage *img, CvRect rect)
+{
+    IplImage region;
+    cvInitImageHeader(&region, cvSize(rect.width, rect.height),
+            IPL_DEPTH_8U, img->nChannels);
+    cvSetData(&region, img->imageData + rect.y * img->widthStep
+            + rect.x * img->nChannels, img->widthStep);
+    return region;
+}
+
+// Whether an outer contour (from CV_RETR_CCOMP) could be a marker, judged
+// from its bounding box, length and area alone -- all much cheaper than
+// approximating its polygon. A marker is a dark, roughly square outline
+// whose white ring makes a hole of about 4/9 of its area (less for a solid
+// blob, more for the frame of a table cell).
+static bool could_be_marker(const CvSeq *contour, int scale)
+{
+    // Large enough to read (as analyze_marker requires), and not too
+    // elongated, even when seen at an angle.
+    CvRect rect = reinterpret_cast<const CvContour *>(contour)->rect;
+    int short_side = std::min(rect.width, rect.height);
+    int long_side = std::max(rect.width, rect.height);
+    if (static_cast<double>(rect.width) * rect.height * scale * scale < 360.0
+            || long_side > 8 * short_side) {
+        return false;
+    }
+
+    // Each step along the boundary of a convex shape moves across or down
+    // its box, so it takes at most 2 * (width + height) steps to go round
+    // (allowing some more for ragged edges).
+    if (contour->total > 2.5 * (rect.width + rect.height)) {
+        return false;
+    }
+
+    // Fill a fair part of the box (a square turned 45 degrees fills half).
+    double area = std::fabs(cvContourArea(contour));
+    if (area * scale * scale < 360.0 || area < 0.25 * rect.width * rect.height) {
+        return false;
+    }
+
+    // Have a hole the size of a marker's white ring.
+    double hole_area = 0.0;
+    for (CvSeq *hole = contour->v_next; hole != 0; hole = hole->h_next) {
+        hole_area = std::max(hole_area, std::fabs(cvContourArea(hole)));
+    }
+    return hole_area >= 0.15 * area && hole_area <= 0.8 * area;
+}
+
+// When only some markers are needed, candidates are analyzed (most likely
+// first) in batches of this many, then twice as many, and so on, until
+// every needed marker has been read at least this clearly (see
+// analyze_marker's confidence, in gray levels).
+static const size_t FIRST_CANDIDATE_BATCH = 8;
+static const double CONFIDENT_READING = 16.0;
+
+// Whether candidate a looks more like a marker than b: squarer (to within
+// a tolerance, since markers are seen at an angle), or as square but larger
+// (small squares are more often print).
+static bool more_likely_marker(const MarkerCandidate &a,
+        const MarkerCandidate &b)
+{
+    int a_rank = static_cast<int>(a.squareness * 10.0);
+    int b_rank = static_cast<int>(b.squareness * 10.0);
+    if (a_rank != b_rank) {
+        return a_rank > b_rank;
+    }
+    return a.area > b.area;
+}
+
+// Candidate markers are analyzed on one thread unless there are at least
+// this many (starting threads costs more than analyzing a few).
+static const size_t MIN_PARALLEL_CANDIDATES = 64;
+
+// Build the remap tables that warp an image onto a page whose markers are at
+// dst_points, given the markers' positions in the image, src_points. They
+// hold, for every page pixel, the image position it comes from, in the same
+// fixed-point form cvWarpPerspective uses internally -- so applying them with
+// cvRemap gives the same page, without recomputing the mapping per pixel.
+static std::shared_ptr<const PageWarp> create_page_warp(
+        const CvMat *src_points, const CvMat *dst_points, CvSize dst_size)
+{
+    // Compute homography matrix, and invert it to map page pixels back
+    // into the image.
+    double h[9];
+    double h_inv[9];
+    CvMat h_mat = cvMat(3, 3, CV_64FC1, h);
+    CvMat h_inv_mat = cvMat(3, 3, CV_64FC1, h_inv);
+    cvFindHomography(src_points, dst_points, &h_mat);
+    cvInvert(&h_mat, &h_inv_mat);
+
+    // Compute the source position of every page pixel.
+    CvMat *map_x = cvCreateMat(dst_size.height, dst_size.width, CV_32FC1);
+    CvMat *map_y = cvCreateMat(dst_size.height, dst_size.width, CV_32FC1);
+    for (int y = 0; y < dst_size.height; y++) {
+        float *row_x = reinterpret_cast<float *>(map_x->data.ptr + y * map_x->step);
+        float *row_y = reinterpret_cast<float *>(map_y->data.ptr + y * map_y->step);
+        for (int x = 0; x < dst_size.width; x++) {
+            double w = h_inv[6] * x + h_inv[7] * y + h_inv[8];
+            w = (w != 0.0) ? 1.0 / w : 0.0;
+            row_x[x] = static_cast<float>((h_inv[0] * x + h_inv[1] * y + h_inv[2]) * w);
+            row_y[x] = static_cast<float>((h_inv[3] * x + h_inv[4] * y + h_inv[5]) * w);
+        }
+    }
+
+    // Convert them to the compact fixed-point form.
+    std::shared_ptr<PageWarp> warp(new PageWarp());
+    warp->map_xy = cvCreateMat(dst_size.height, dst_size.width, CV_16SC2);
+    warp->map_alpha = cvCreateMat(dst_size.height, dst_size.width, CV_16UC1);
+    cvConvertMaps(map_x, map_y, warp->map_xy, warp->map_alpha);
+
+    // Clean up.
+    cvReleaseMat(&map_x);
+    cvReleaseMat(&map_y);
+
+    return warp;
+}
 
-BookImage::BookImage(const IplImage *src_img) : src_img(cvCloneImage(src_img))
+BookImage::BookImage(const IplImage *src_img, const DetectionOptions &options,
+        RigSession *session, ImageStats *stats)
+    : src_img(src_img), preview_img(NULL), session(session),
+    session_generation(0), stats(stats),
+    analysis_threads(options.analysis_threads),
+    required_markers(options.required_markers)
 {
-    // Create grayscale image.
-    IplImage *gray_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 1);
-    cvCvtColor(src_img, gray_img, CV_BGR2GRAY);
+    StatsTimer detect_timer(stats, STATS_DETECT);
 
-    // Threshold.
-    IplImage *bw_img = cvCreateImage(cvGetSize(src_img), IPL_DEPTH_8U, 1);
-    cvAdaptiveThreshold(gray_img, bw_img, 128,
-            CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV, 11+20, 8);
+    // Work in the caller's buffers if given, or else in our own.
+    DetectionContext local_context;
+    DetectionContext &context = (options.context != NULL)
+            ? *options.context : local_context;
+
+    // If the session knows where the markers were, check whether they're
+    // still there; otherwise (or if they've moved), search around where the
+    // tracker expects them, or failing that the whole image.
+    std::map<int, MarkerCorners> cached_markers;
+    unsigned long cached_generation;
+    bool have_cached = session != NULL
+            && session->begin_image(cached_markers, cached_generation);
+    std::map<int, MarkerCorners> predicted_markers;
+    bool have_prediction = !have_cached && options.tracker != NULL
+            && options.tracker->predict(predicted_markers);
+
+    // If the whole image is certain to be searched, and it's too large to
+    // search at once within the memory budget, it's searched tile by tile
+    // (without a grayscale copy of the whole image).
+    bool tiled = !have_cached && !have_prediction && options.tile_memory > 0
+            && 2.0 * src_img->width * src_img->height > options.tile_memory;
+
+    // If the whole image is certain to be searched at full resolution, its
+    // conversion to grayscale and its thresholding are done together, in
+    // one pass.
+    bool search_whole_image = !have_cached && !have_prediction && !tiled
+            && src_img->nChannels == 3
+            && (options.max_detection_size <= 0
+                || std::max(src_img->width, src_img->height)
+                    <= options.max_detection_size);
+
+    // Create grayscale image (unless this is already a grayscale preview).
+    IplImage gray_img;
+    IplImage bw_img;
+    const IplImage *detect_gray_img = NULL;
+    if (src_img->nChannels == 1) {
+        preview_img = src_img;
+        this->src_img = NULL;
+        detect_gray_img = preview_img;
+    } else if (tiled) {
+        // (Each tile is converted as it's searched.)
+    } else if (search_whole_image) {
+        // (Timed as thresholding, which is most of the work.)
+        StatsTimer timer(stats, STATS_THRESHOLD);
+        gray_img = context.gray_image(cvGetSize(src_img));
+        bw_img = context.threshold_image(cvGetSize(src_img));
+        bgr_to_gray_threshold_mean_inv(src_img, &gray_img, &bw_img, 128,
+                threshold_block_size(1), 8, context.threshold_sums());
+        detect_gray_img = &gray_img;
+    } else {
+        StatsTimer timer(stats, STATS_GRAY);
+        gray_img = context.gray_image(cvGetSize(src_img));
+        cvCvtColor(src_img, &gray_img, CV_BGR2GRAY);
+        detect_gray_img = &gray_img;
+    }
+
+    std::map<int, MarkerCorners> verified_markers;
+    if (have_cached && verify_markers(detect_gray_img, cached_markers,
+                session->drift_tolerance(), verified_markers)) {
+        src_markers = verified_markers;
+        session_generation = cached_generation;
+        session->record_verified();
+        if (stats != NULL) {
+            stats->add_count(STATS_MARKERS_FOUND, src_markers.size());
+        }
+    } else {
+        if (have_cached && options.tracker != NULL) {
+            have_prediction = options.tracker->predict(predicted_markers);
+        }
+        bool tracked = have_prediction
+                && track_markers(detect_gray_img, predicted_markers, context);
+        if (!tracked) {
+            src_markers.clear();
+            src_confidences.clear();
+            if (tiled) {
+                detect_tiled(src_img, options);
+            } else if (search_whole_image) {
+                search_thresholded(detect_gray_img, &bw_img, cvPoint(0, 0), 1,
+                        context);
+            } else {
+                detect_markers(detect_gray_img, options, context);
+            }
+        }
+        if (options.tracker != NULL) {
+            options.tracker->record(src_markers, !tracked);
+        }
+        if (session != NULL) {
+            session_generation = session->record_detected(src_markers);
+        }
+    }
+}
+
+BookImage::BookImage(const IplImage *src_img,
+        const std::map<int, MarkerCorners> &known_markers, ImageStats *stats)
+    : src_img(src_img), preview_img(NULL), src_markers(known_markers),
+    session(NULL), session_generation(0), stats(stats), analysis_threads(1),
+    required_markers(0)
+{
+}
+
+void BookImage::detect_markers(const IplImage *gray_img,
+        const DetectionOptions &options, DetectionContext &context)
+{
+    // For large images, look for markers on a downscaled (pyramid) copy of
+    // the image instead; analyze_marker then refines the corners it finds
+    // on the full-resolution image.
+    // Each level has its own buffer in the context, since it's made from
+    // the level above.
+    IplImage pyramid_img;
+    const IplImage *detect_img = gray_img;
+    int scale = 1;
+    {
+        StatsTimer timer(stats, STATS_PYRAMID);
+        for (int level = 0; options.max_detection_size > 0
+                && std::max(detect_img->width, detect_img->height)
+                    > options.max_detection_size; level++) {
+            IplImage half_img = context.pyramid_image(level,
+                    cvSize((detect_img->width + 1) / 2, (detect_img->height + 1) / 2));
+            cvPyrDown(detect_img, &half_img);
+            pyramid_img = half_img;
+            detect_img = &pyramid_img;
+            scale *= 2;
+        }
+    }
+
+    search_region(gray_img, detect_img, cvRect(0, 0, detect_img->width,
+            detect_img->height), scale, context);
+}
+
+bool BookImage::track_markers(const IplImage *gray_img,
+        const std::map<int, MarkerCorners> &predicted_markers,
+        DetectionContext &context)
+{
+    // Search a window around each predicted marker, as wide again as the
+    // marker on each side (to allow for faster motion than predicted), and
+    // at least wide enough for the threshold block.
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+    for (MCCIT it = predicted_markers.begin(); it != predicted_markers.end(); ++it) {
+        const CvPoint2D32f *points = it->second.points;
+        float min_x = points[0].x, max_x = points[0].x;
+        float min_y = points[0].y, max_y = points[0].y;
+        for (int i = 1; i < 4; i++) {
+            min_x = std::min(min_x, points[i].x);
+            max_x = std::max(max_x, points[i].x);
+            min_y = std::min(min_y, points[i].y);
+            max_y = std::max(max_y, points[i].y);
+        }
+        int margin = std::max(32, static_cast<int>(std::max(max_x - min_x,
+                max_y - min_y)));
+        int left = std::max(0, static_cast<int>(min_x) - margin);
+        int top = std::max(0, static_cast<int>(min_y) - margin);
+        int right = std::min(gray_img->width, static_cast<int>(max_x) + margin + 1);
+        int bottom = std::min(gray_img->height, static_cast<int>(max_y) + margin + 1);
+        if (right <= left || bottom <= top) {
+            return false;
+        }
+
+        search_region(gray_img, gray_img,
+                cvRect(left, top, right - left, bottom - top), 1, context);
+        if (src_markers.find(it->first) == src_markers.end()) {
+            return false; // Lost it.
+        }
+    }
 
+    return true;
+}
+
+void BookImage::search_region(const IplImage *gray_img,
+        const IplImage *detect_img, CvRect region, int scale,
+        DetectionContext &context)
+{
+    // Only the region of detect_img is thresholded and searched; the
+    // contours found in it are offset back to whole-image coordinates.
+    IplImage region_img = *detect_img;
+    region_img.roi = NULL;
+    cvSetImageROI(&region_img, region);
+
+    // Threshold (as cvAdaptiveThreshold with CV_ADAPTIVE_THRESH_MEAN_C and
+    // CV_THRESH_BINARY_INV would).
+    IplImage bw_img = context.threshold_image(cvSize(region.width,
+            region.height));
+    {
+        StatsTimer timer(stats, STATS_THRESHOLD);
+        threshold_mean_inv(&region_img, &bw_img, 128,
+                threshold_block_size(scale), 8, context.threshold_sums());
+    }
+    cvResetImageROI(&region_img);
+
+    search_thresholded(gray_img, &bw_img, cvPoint(region.x, region.y), scale,
+            context);
+}
+
+void BookImage::search_thresholded(const IplImage *gray_img, IplImage *bw_img,
+        CvPoint offset, int scale, DetectionContext &context)
+{
+    find_candidates(gray_img, bw_img, offset, scale, context,
+            analysis_threads, required_markers);
+    merge_candidates(context.marker_candidates());
+}
+
+void BookImage::find_candidates(const IplImage *gray_img, IplImage *bw_img,
+        CvPoint offset, int scale, DetectionContext &context, int threads,
+        unsigned int required)
+{
     // Find contours.
-    CvMemStorage* storage = cvCreateMemStorage(0);
+    CvMemStorage* storage = context.memory_storage();
     CvSeq *contour;
-    cvFindContours(bw_img, storage, &contour, sizeof(CvContour),
-            CV_RETR_LIST, CV_CHAIN_APPROX_NONE, cvPoint(0,0));
+    {
+        StatsTimer timer(stats, STATS_CONTOURS);
+        cvFindContours(bw_img, storage, &contour, sizeof(CvContour),
+                CV_RETR_CCOMP, CV_CHAIN_APPROX_NONE, offset);
+    }
 
-    // Examine each contour that was found.
+    // Keep each contour that was found that's a convex quadrilateral as a
+    // candidate marker. Only outer boundaries are looked at: the holes in
+    // them (the inside edges of markers' borders, letters' counters, and
+    // so on) are their children, and can never be markers.
+    std::vector<MarkerCandidate> &candidates = context.marker_candidates();
+    candidates.clear();
     for(; contour != 0; contour = contour->h_next) {
-        CvSeq *poly = cvApproxPoly(contour, sizeof(CvContour), NULL,
-                CV_POLY_APPROX_DP, 6.0);
+        if (stats != NULL) {
+            long holes = 0;
+            for (CvSeq *hole = contour->v_next; hole != 0; hole = hole->h_next) {
+                holes++;
+            }
+            stats->add_count(STATS_CONTOURS_FOUND, 1 + holes);
+            stats->add_count(STATS_PRUNED, holes);
+        }
+
+        {
+            StatsTimer timer(stats, STATS_PRUNE);
+            if (!could_be_marker(contour, scale)) {
+                if (stats != NULL) { stats->add_count(STATS_PRUNED); }
+                continue;
+            }
+        }
+
+        CvSeq *poly;
+        {
+            StatsTimer timer(stats, STATS_APPROX);
+            poly = cvApproxPoly(contour, sizeof(CvContour), NULL,
+                    CV_POLY_APPROX_DP, std::max(6.0 / scale, 1.0));
+        }
         // Make sure that contour is quadrilateral and convex.
-        if (poly->total != 4 || !cvCheckContourConvexity(poly)) {
+        if (poly->total != 4) {
+            if (stats != NULL) { stats->add_count(STATS_REJECTED_POINTS); }
             continue;
         }
+        if (!cvCheckContourConvexity(poly)) {
+            if (stats != NULL) { stats->add_count(STATS_REJECTED_CONVEXITY); }
+            continue;
+        }
+
+        // (16 * area / perimeter^2 is 1 for a square, and less for any
+        // other quadrilateral.)
+        MarkerCandidate candidate;
+        candidate.poly = poly;
+        candidate.area = std::fabs(cvContourArea(poly));
+        double perimeter = cvArcLength(poly, CV_WHOLE_SEQ, 1);
+        candidate.squareness = (perimeter > 0.0)
+                ? 16.0 * candidate.area / (perimeter * perimeter) : 0.0;
+        candidate.id = -1;
+        candidate.confidence = 0.0;
+        candidates.push_back(candidate);
+    }
+
+    // If only some markers are needed, analyze the likeliest candidates
+    // first, and stop once those markers have all been found.
+    unsigned int found = 0;
+    if (required != 0) {
+        std::stable_sort(candidates.begin(), candidates.end(),
+                more_likely_marker);
+        typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+        for (MCCIT it = src_markers.begin(); it != src_markers.end(); ++it) {
+            found |= 1u << it->first;
+        }
+    }
 
-        CvPoint2D32f points[4];
-        int marker_id = analyze_marker(gray_img, poly, points);
-        if (marker_id != -1) {
-            src_markers[marker_id] = points[0];
+    // Analyze the candidates, in batches that double in size when stopping
+    // early (so that, whatever the number of threads, the same candidates
+    // are analyzed). Each is independent of the others, so when there are
+    // enough of them to be worth starting threads for, they're spread over
+    // several.
+    size_t begin = 0;
+    size_t batch = (required != 0) ? FIRST_CANDIDATE_BATCH : candidates.size();
+    while (begin < candidates.size() && (required == 0
+                || (found & required) != required)) {
+        size_t end = std::min(candidates.size(), begin + batch);
+        int batch_threads = (end - begin < MIN_PARALLEL_CANDIDATES
+                || show_marker_debug_window) ? 1 : threads;
+        parallel_for(static_cast<int>(end - begin), batch_threads, [&](int i) {
+            MarkerCandidate &candidate = candidates[begin + i];
+            StatsTimer timer(stats, STATS_ANALYZE);
+            candidate.id = analyze_marker(gray_img, candidate.poly,
+                    candidate.corners.points, scale, stats,
+                    &candidate.confidence);
+        });
+        for (size_t i = begin; i < end; i++) {
+            if (candidates[i].id >= 0
+                    && candidates[i].confidence >= CONFIDENT_READING) {
+                found |= 1u << candidates[i].id;
+            }
         }
+        begin = end;
+        batch *= 2;
+    }
+    if (stats != NULL) {
+        stats->add_count(STATS_SKIPPED, candidates.size() - begin);
     }
+}
 
-    // Clean up.
-    cvReleaseMemStorage(&storage);
-    cvReleaseImage(&gray_img);
-    cvReleaseImage(&bw_img);
+void BookImage::merge_candidates(const std::vector<MarkerCandidate> &candidates)
+{
+    // Merge the markers found, in order (of contour, or likelihood, and of
+    // tile) so that the result doesn't depend on the threads. Where several
+    // candidates read as the same marker (e.g., both edges of its border),
+    // keep the one read most clearly, or the last of those equally clear.
+    const MarkerCandidate *best[NUMBER_OF_MARKER_IDS] = {};
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const MarkerCandidate &candidate = candidates[i];
+        if (candidate.id < 0 || candidate.id >= NUMBER_OF_MARKER_IDS) {
+            continue;
+        }
+        if (best[candidate.id] == NULL
+                || candidate.confidence >= best[candidate.id]->confidence) {
+            best[candidate.id] = &candidate;
+        }
+    }
+    for (int id = 0; id < NUMBER_OF_MARKER_IDS; id++) {
+        if (best[id] != NULL) {
+            src_markers[id] = best[id]->corners;
+            src_confidences[id] = best[id]->confidence;
+        }
+    }
+}
+
+void BookImage::detect_tiled(const IplImage *img,
+        const DetectionOptions &options)
+{
+    int threads = options.analysis_threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (show_marker_debug_window) {
+        threads = 1;
+    }
+
+    // Each thread searches a tile at a time, with a grayscale and a
+    // thresholded copy of it: make the tiles as large as the budget allows
+    // for that, but at least twice the overlap, using fewer threads if the
+    // budget can't hold a tile of that size for each.
+    size_t thread_budget = minimum_tile_memory(options.tile_overlap);
+    if (options.tile_memory / thread_budget < static_cast<size_t>(threads)) {
+        threads = std::max(static_cast<size_t>(1),
+                options.tile_memory / thread_budget);
+    }
+    double tile_pixels = static_cast<double>(options.tile_memory)
+            / (2.0 * threads);
+    int tile_size = std::max(static_cast<int>(std::sqrt(tile_pixels)),
+            2 * options.tile_overlap);
+    int stride = tile_size - options.tile_overlap;
+
+    std::vector<CvRect> tiles;
+    for (int y = 0; ; y += stride) {
+        for (int x = 0; ; x += stride) {
+            tiles.push_back(cvRect(x, y, std::min(tile_size, img->width - x),
+                    std::min(tile_size, img->height - y)));
+            if (x + tile_size >= img->width) {
+                break;
+            }
+        }
+        if (y + tile_size >= img->height) {
+            break;
+        }
+    }
+
+    // Search the tiles (several at once, if there are threads for that,
+    // rather than analyzing each tile's candidates in parallel), and merge
+    // the markers found in all of them. A marker in the overlap of two
+    // tiles is found in both; the merge keeps one.
+    std::vector<std::vector<MarkerCandidate> > found(tiles.size());
+    parallel_for(static_cast<int>(tiles.size()), threads, [&](int t) {
+        DetectionContext context;
+        search_tile(img, tiles[t], context, found[t]);
+    });
+
+    std::vector<MarkerCandidate> candidates;
+    for (size_t t = 0; t < found.size(); t++) {
+        candidates.insert(candidates.end(), found[t].begin(), found[t].end());
+    }
+    merge_candidates(candidates);
+}
+
+void BookImage::search_tile(const IplImage *img, CvRect tile,
+        DetectionContext &context, std::vector<MarkerCandidate> &found)
+{
+    // Threshold the tile (converting it to grayscale first, unless it
+    // already is), on its own.
+    IplImage tile_img = image_region(img, tile);
+    CvSize size = cvSize(tile.width, tile.height);
+    IplImage gray_img;
+    IplImage bw_img = context.threshold_image(size);
+    {
+        StatsTimer timer(stats, STATS_THRESHOLD);
+        if (img->nChannels == 1) {
+            gray_img = tile_img;
+            threshold_mean_inv(&gray_img, &bw_img, 128,
+                    threshold_block_size(1), 8, context.threshold_sums());
+        } else {
+            gray_img = context.gray_image(size);
+            bgr_to_gray_threshold_mean_inv(&tile_img, &gray_img, &bw_img, 128,
+                    threshold_block_size(1), 8, context.threshold_sums());
+        }
+    }
+
+    find_candidates(&gray_img, &bw_img, cvPoint(0, 0), 1, context, 1, 0);
+
+    // Keep only the markers well inside the tile: near an edge it shares
+    // with another tile, a marker may be cut off or thresholded differently
+    // than in the whole image, but the overlap makes sure it's well inside
+    // the next tile.
+    float left = (tile.x > 0) ? TILE_EDGE_MARGIN : 0;
+    float top = (tile.y > 0) ? TILE_EDGE_MARGIN : 0;
+    float right = tile.width
+            - ((tile.x + tile.width < img->width) ? TILE_EDGE_MARGIN : 0);
+    float bottom = tile.height
+            - ((tile.y + tile.height < img->height) ? TILE_EDGE_MARGIN : 0);
+    const std::vector<MarkerCandidate> &candidates = context.marker_candidates();
+    for (size_t i = 0; i < candidates.size(); i++) {
+        MarkerCandidate candidate = candidates[i];
+        if (candidate.id < 0) {
+            continue;
+        }
+        bool inside = true;
+        for (int k = 0; k < 4; k++) {
+            CvPoint2D32f &point = candidate.corners.points[k];
+            inside = inside && point.x >= left && point.x < right
+                    && point.y >= top && point.y < bottom;
+            point.x += tile.x;
+            point.y += tile.y;
+        }
+        if (inside) {
+            candidate.poly = NULL; // Its storage is about to go.
+            found.push_back(candidate);
+        }
+    }
+}
+
+bool BookImage::verify_markers(const IplImage *gray_img,
+        const std::map<int, MarkerCorners> &cached_markers,
+        double tolerance, std::map<int, MarkerCorners> &verified_markers)
+{
+    StatsTimer timer(stats, STATS_VERIFY);
+
+    // Re-read each marker where it was, and make sure it's the same marker,
+    // in the same orientation, and hasn't drifted. A marker that can't be
+    // read there at all is taken to be covered (e.g., by a hand turning the
+    // page), as long as some of the others are still in place: the rig
+    // hasn't moved, so the covered one will be back where it was.
+    verified_markers.clear();
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+    for (MCCIT it = cached_markers.begin(); it != cached_markers.end(); ++it) {
+        MarkerCorners found = it->second;
+        int id = analyze_marker_corners(gray_img, found.points);
+        if (id == -1) {
+            continue;
+        }
+        if (id != it->first) {
+            return false;
+        }
+        for (int i = 0; i < 4; i++) {
+            double dx = found.points[i].x - it->second.points[i].x;
+            double dy = found.points[i].y - it->second.points[i].y;
+            if (dx * dx + dy * dy > tolerance * tolerance) {
+                return false;
+            }
+        }
+        verified_markers[it->first] = it->second;
+    }
+
+    return !verified_markers.empty();
 }
 
 BookImage::~BookImage()
 {
-    // Clean up.
-    cvReleaseImage(&src_img);
+    // Nothing to clean up: the images belong to the caller.
 }
 
-IplImage *BookImage::create_page_image(
-        const std::map<int, CvPoint2D32f> &dst_markers,
-        CvSize dst_size)
+bool BookImage::has_markers(const std::map<int, CvPoint2D32f> &dst_markers) const
 {
-    // Make sure more than 4 makers are provided.
-    if (dst_markers.size() < 4) {
-        return NULL;
+    typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
+    for (MMCIT dit = dst_markers.begin(); dit != dst_markers.end(); ++dit) {
+        if (src_markers.find(dit->first) == src_markers.end()) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Create matrices for perspective transform.
-    CvMat *src_points = cvCreateMat(dst_markers.size(), 2, CV_64FC1);
-    CvMat *dst_points = cvCreateMat(dst_markers.size(), 2, CV_64FC1);
+void BookImage::set_source_image(const IplImage *full_img,
+        DetectionContext *context)
+{
+    src_img = full_img;
+    if (preview_img == NULL) {
+        return;
+    }
+
+    // How much larger the full image is than the preview (the reduced JPEG
+    // decode rounds sizes up).
+    double scale_x = static_cast<double>(full_img->width) / preview_img->width;
+    double scale_y = static_cast<double>(full_img->height) / preview_img->height;
+    int scale = std::max(1, static_cast<int>(std::max(scale_x, scale_y) + 0.5));
+
+    StatsTimer timer(stats, STATS_ANALYZE);
+    typedef std::map<int, MarkerCorners>::iterator MIT;
+    for (MIT it = src_markers.begin(); it != src_markers.end(); ++it) {
+        CvPoint2D32f *points = it->second.points;
+        for (int i = 0; i < 4; i++) {
+            points[i].x = (points[i].x + 0.5) * scale_x - 0.5;
+            points[i].y = (points[i].y + 0.5) * scale_y - 0.5;
+        }
+
+        // Refine the corners at full resolution. Only the area around the
+        // marker needs converting to grayscale for that.
+        float min_x = points[0].x, max_x = points[0].x;
+        float min_y = points[0].y, max_y = points[0].y;
+        for (int i = 1; i < 4; i++) {
+            min_x = std::min(min_x, points[i].x);
+            max_x = std::max(max_x, points[i].x);
+            min_y = std::min(min_y, points[i].y);
+            max_y = std::max(max_y, points[i].y);
+        }
+        int margin = 4 * scale + 8;
+        int left = std::max(0, static_cast<int>(min_x) - margin);
+        int top = std::max(0, static_cast<int>(min_y) - margin);
+        int right = std::min(full_img->width, static_cast<int>(max_x) + margin + 1);
+        int bottom = std::min(full_img->height, static_cast<int>(max_y) + margin + 1);
+        if (right <= left || bottom <= top) {
+            continue;
+        }
+
+        IplImage roi_img = *full_img;
+        roi_img.roi = NULL;
+        cvSetImageROI(&roi_img, cvRect(left, top, right - left, bottom - top));
+        CvSize patch_size = cvSize(right - left, bottom - top);
+        IplImage patch_buffer;
+        IplImage *patch_img;
+        if (context != NULL) {
+            patch_buffer = context->gray_image(patch_size);
+            patch_img = &patch_buffer;
+        } else {
+            patch_img = cvCreateImage(patch_size, IPL_DEPTH_8U, 1);
+        }
+        cvCvtColor(&roi_img, patch_img, CV_BGR2GRAY);
+        cvResetImageROI(&roi_img);
+
+        for (int i = 0; i < 4; i++) {
+            points[i].x -= left;
+            points[i].y -= top;
+        }
+        refine_marker_corners(patch_img, points, scale);
+        for (int i = 0; i < 4; i++) {
+            points[i].x += left;
+            points[i].y += top;
+        }
+
+        if (context == NULL) {
+            cvReleaseImage(&patch_img);
+        }
+    }
+
+    preview_img = NULL;
+}
+
+bool BookImage::find_page_points(
+        const std::map<int, CvPoint2D32f> &dst_markers,
+        const LayoutInfo *layout, CvMat *src_points, CvMat *dst_points) const
+{
+    // Make sure more than 4 makers are provided, and that there's a
+    // full-size image to render from.
+    if (dst_markers.size() < 4 || dst_markers.size() > MAX_PAGE_MARKERS
+            || src_img == NULL) {
+        return false;
+    }
 
     typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
     int row = 0;
-    
-    std::cout << "The following markers are recognized: ";
+
+    // Build the message up first and print it in one go, so that pages
+    // rendered on different threads don't interleave their output. (It goes
+    // into a fixed buffer, so that rendering a page allocates nothing.)
+    char message[256];
+    int length = snprintf(message, sizeof(message),
+            "The following markers are recognized: ");
 
     for (MMCIT dit = dst_markers.begin(); dit != dst_markers.end(); ++dit) {
         // Find a source marker with the specified ID.
-        MMCIT sit = src_markers.find(dit->first);
+        MCCIT sit = src_markers.find(dit->first);
 
         // Make sure the marker specified exists.
         if (sit == src_markers.end()) {
-            // Couldn't find the marker: clean up and return NULL.
-            cvReleaseMat(&src_points);
-            cvReleaseMat(&dst_points);
-            std::cout << "Couldn't find " << dit->first << "\n";
-            return NULL;
+            snprintf(message + length, sizeof(message) - length,
+                    "Couldn't find %d\n", dit->first);
+            std::cout << message;
+            return false;
         }
 
-        std::cout << dit->first << " ";
+        length += snprintf(message + length, sizeof(message) - length,
+                "%d ", dit->first);
 
-        // Update the matrice.
-        cvmSet(src_points, row, 0, sit->second.x);
-        cvmSet(src_points, row, 1, sit->second.y);
-        cvmSet(dst_points, row, 0, dit->second.x);
-        cvmSet(dst_points, row, 1, dit->second.y);
+        // Update the matrice. (Page positions are converted to pixels.)
+        double dst_x = dit->second.x;
+        double dst_y = dit->second.y;
+        if (layout != NULL) {
+            dst_x = (dst_x - layout->page_left) * layout->dpi;
+            dst_y = (dst_y - layout->page_top) * layout->dpi;
+        }
+        cvmSet(src_points, row, 0, sit->second.points[0].x);
+        cvmSet(src_points, row, 1, sit->second.points[0].y);
+        cvmSet(dst_points, row, 0, dst_x);
+        cvmSet(dst_points, row, 1, dst_y);
 
         row++;
     }
-    std::cout << "\n";
+    snprintf(message + length, sizeof(message) - length, "\n");
+    std::cout << message;
 
-    // Create destination image.
-    IplImage *dst_image = cvCreateImage(dst_size, IPL_DEPTH_8U, 3);
+    return true;
+}
+
+void BookImage::warp_page(const CvMat *src_points, const CvMat *dst_points,
+        IplImage *dst_image) const
+{
+    // If the markers are the session's, this page has likely been rendered
+    // from them before: reuse the remap tables built for it then. The
+    // session's generation stands for where the markers are, so only the
+    // page's own geometry tells its tables apart. (src_points can't: when
+    // the markers were verified on a preview, they're refined afresh on
+    // each full-size image, and differ slightly every time.)
+    if (session_generation != 0) {
+        std::vector<double> page_key;
+        page_key.push_back(dst_image->width);
+        page_key.push_back(dst_image->height);
+        for (int row = 0; row < dst_points->rows; row++) {
+            page_key.push_back(cvmGet(dst_points, row, 0));
+            page_key.push_back(cvmGet(dst_points, row, 1));
+        }
+
+        std::shared_ptr<const PageWarp> warp;
+        {
+            StatsTimer timer(stats, STATS_HOMOGRAPHY);
+            warp = session->find_page_warp(session_generation, page_key);
+            if (!warp) {
+                warp = create_page_warp(src_points, dst_points,
+                        cvGetSize(dst_image));
+                session->store_page_warp(session_generation, page_key, warp);
+            }
+        }
+        {
+            StatsTimer timer(stats, STATS_WARP);
+            cvRemap(src_img, dst_image, warp->map_xy, warp->map_alpha,
+                    CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
+        }
+        return;
+    }
 
     // Compute homography matrix.
-    CvMat *h = cvCreateMat(3, 3, CV_64FC1);
-    cvFindHomography(src_points, dst_points, h);
+    double h[9];
+    CvMat h_mat = cvMat(3, 3, CV_64FC1, h);
+    {
+        StatsTimer timer(stats, STATS_HOMOGRAPHY);
+        cvFindHomography(src_points, dst_points, &h_mat);
+    }
 
-    // Transform perspective.
-    cvWarpPerspective(src_img, dst_image, h);
+    // Transform perspective (in bands of rows, on every core).
+    {
+        StatsTimer timer(stats, STATS_WARP);
+        warp_perspective(src_img, dst_image, &h_mat);
+    }
+}
 
-    // Clean up.
-    cvReleaseMat(&src_points);
-    cvReleaseMat(&dst_points);
-    cvReleaseMat(&h);
+IplImage *BookImage::create_page_image(
+        const std::map<int, CvPoint2D32f> &dst_markers,
+        CvSize dst_size) const
+{
+    // Matrices for the perspective transform (on the stack: there are never
+    // more than MAX_PAGE_MARKERS markers).
+    double src_data[MAX_PAGE_MARKERS * 2];
+    double dst_data[MAX_PAGE_MARKERS * 2];
+    CvMat src_points = cvMat(dst_markers.size(), 2, CV_64FC1, src_data);
+    CvMat dst_points = cvMat(dst_markers.size(), 2, CV_64FC1, dst_data);
+    if (!find_page_points(dst_markers, NULL, &src_points, &dst_points)) {
+        return NULL;
+    }
 
+    // Create destination image.
+    IplImage *dst_image = cvCreateImage(dst_size, IPL_DEPTH_8U, 3);
+    warp_page(&src_points, &dst_points, dst_image);
     return dst_image;
 }
 
 IplImage *BookImage::create_page_image(
         const std::map<int, CvPoint2D32f> &dst_markers,
-        const LayoutInfo &layout)
+        const LayoutInfo &layout) const
+{
+    double src_data[MAX_PAGE_MARKERS * 2];
+    double dst_data[MAX_PAGE_MARKERS * 2];
+    CvMat src_points = cvMat(dst_markers.size(), 2, CV_64FC1, src_data);
+    CvMat dst_points = cvMat(dst_markers.size(), 2, CV_64FC1, dst_data);
+    if (!find_page_points(dst_markers, &layout, &src_points, &dst_points)) {
+        return NULL;
+    }
+
+    IplImage *dst_image = cvCreateImage(page_image_size(layout), IPL_DEPTH_8U, 3);
+    warp_page(&src_points, &dst_points, dst_image);
+    return dst_image;
+}
+
+bool BookImage::render_page_image(
+        const std::map<int, CvPoint2D32f> &dst_markers,
+        const LayoutInfo &layout, IplImage *dst_img) const
+{
+    double src_data[MAX_PAGE_MARKERS * 2];
+    double dst_data[MAX_PAGE_MARKERS * 2];
+    CvMat src_points = cvMat(dst_markers.size(), 2, CV_64FC1, src_data);
+    CvMat dst_points = cvMat(dst_markers.size(), 2, CV_64FC1, dst_data);
+    if (!find_page_points(dst_markers, &layout, &src_points, &dst_points)) {
+        return false;
+    }
+
+    warp_page(&src_points, &dst_points, dst_img);
+    return true;
+}
+
+std::vector<IplImage *> BookImage::create_page_images(
+        const std::vector<PageSpec> &pages,
+        const std::vector<std::string> &output_paths,
+        PageRenderer *renderer) const
+{
+    std::vector<IplImage *> page_imgs(pages.size(), NULL);
+
+    parallel_for(pages.size(), pages.size(), [&](int i) {
+        if (renderer != NULL) {
+            page_imgs[i] = renderer->render(*this, pages[i].dst_markers,
+                    pages[i].layout);
+        } else {
+            page_imgs[i] = create_page_image(pages[i].dst_markers,
+                    pages[i].layout);
+        }
+        if (page_imgs[i] != NULL && static_cast<size_t>(i) < output_paths.size()
+                && !output_paths[i].empty()) {
+            StatsTimer timer(stats, STATS_SAVE);
+            // Replace the old page, rather than write through it, in case
+            // it's a hard link into a result cache.
+            std::remove(output_paths[i].c_str());
+            cvSaveImage(output_paths[i].c_str(), page_imgs[i]);
+        }
+    });
+
+    return page_imgs;
+}
+
+unsigned int marker_mask(const std::vector<PageSpec> &pages)
+{
+    unsigned int mask = 0;
+    for (size_t i = 0; i < pages.size(); i++) {
+        typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
+        for (MMCIT it = pages[i].dst_markers.begin();
+                it != pages[i].dst_markers.end(); ++it) {
+            mask |= 1u << it->first;
+        }
+    }
+    return mask;
+}
+
+size_t minimum_tile_memory(int tile_overlap)
+{
+    size_t tile_size = 2 * static_cast<size_t>(std::max(tile_overlap, 1));
+    return 2 * tile_size * tile_size;
+}
+
+CvSize page_image_size(const LayoutInfo &layout)
 {
     // Get the destination image size in pixel.
     double page_width_px = (layout.page_right - layout.page_left) * layout.dpi;
     double page_height_px = (layout.page_bottom - layout.page_top) * layout.dpi;
-    CvSize pageSize = cvSize(
-            static_cast<int>(page_width_px + 0.5),
-            static_cast<int>(page_height_px + 0.5));
 
     // For debugging, uncomment the line below to see page width and height.
     //std::cout << "Page width: " << page_width_px << "; Page height: " << page_height_px << "\n";
 
-    // Convert marker positions to pixel representation.
-    std::map<int, CvPoint2D32f> dst_markers_px;
-    typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
-    for (MMCIT dit = dst_markers.begin(); dit != dst_markers.end(); ++dit) {
-        dst_markers_px[dit->first] = cvPoint2D32f(
-                (dit->second.x - layout.page_left) * layout.dpi,
-                (dit->second.y - layout.page_top) * layout.dpi);
+    return cvSize(
+            static_cast<int>(page_width_px + 0.5),
+            static_cast<int>(page_height_px + 0.5));
+}
+
+IplImage *load_preview_image(const char *path, int scale)
+{
+    int flags;
+    switch (scale) {
+    case 2:
+        flags = cv::IMREAD_REDUCED_GRAYSCALE_2;
+        break;
+    case 4:
+        flags = cv::IMREAD_REDUCED_GRAYSCALE_4;
+        break;
+    case 8:
+        flags = cv::IMREAD_REDUCED_GRAYSCALE_8;
+        break;
+    default:
+        flags = CV_LOAD_IMAGE_GRAYSCALE;
+        break;
+    }
+
+    return cvLoadImage(path, flags);
+}
+
+// Read a big-endian number of bytes bytes from file.
+static bool read_big_endian(std::FILE *file, int bytes, unsigned long &value)
+{
+    value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int c = std::fgetc(file);
+        if (c == EOF) {
+            return false;
+        }
+        value = (value << 8) | static_cast<unsigned long>(c);
+    }
+    return true;
+}
+
+bool read_image_size(const char *path, CvSize &size)
+{
+    std::FILE *file = std::fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool found = false;
+    unsigned char signature[8];
+    size_t length = std::fread(signature, 1, sizeof(signature), file);
+    static const unsigned char PNG_SIGNATURE[8]
+            = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (length == 8 && std::equal(signature, signature + 8, PNG_SIGNATURE)) {
+        // The first chunk is IHDR, which starts with the width and height.
+        unsigned long chunk_length, chunk_type, width, height;
+        found = read_big_endian(file, 4, chunk_length)
+                && read_big_endian(file, 4, chunk_type)
+                && chunk_type == 0x49484452 // "IHDR"
+                && read_big_endian(file, 4, width)
+                && read_big_endian(file, 4, height);
+        size = cvSize(static_cast<int>(width), static_cast<int>(height));
+    } else if (length >= 2 && signature[0] == 0xff && signature[1] == 0xd8) {
+        // Walk the JPEG's segments up to its start of frame (SOF0 to SOF15,
+        // bar DHT, JPG and DAC, which share the range).
+        std::fseek(file, 2, SEEK_SET);
+        for (;;) {
+            int c = std::fgetc(file);
+            if (c != 0xff) {
+                break;
+            }
+            int marker;
+            do {
+                marker = std::fgetc(file);
+            } while (marker == 0xff);
+            if (marker == EOF || marker == 0xd9 || marker == 0xda) {
+                break; // End of image, or start of scan: no frame header.
+            }
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+                continue; // Markers without a segment.
+            }
+            unsigned long segment_length;
+            if (!read_big_endian(file, 2, segment_length)
+                    || segment_length < 2) {
+                break;
+            }
+            if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4
+                    && marker != 0xc8 && marker != 0xcc) {
+                unsigned long precision, height, width;
+                found = read_big_endian(file, 1, precision)
+                        && read_big_endian(file, 2, height)
+                        && read_big_endian(file, 2, width);
+                size = cvSize(static_cast<int>(width),
+                        static_cast<int>(height));
+                break;
+            }
+            if (std::fseek(file, static_cast<long>(segment_length) - 2,
+                    SEEK_CUR) != 0) {
+                break;
+            }
+        }
     }
 
-    // Return page image.
-    return create_page_image(dst_markers_px, pageSize);
+    std::fclose(file);
+    return found && size.width > 0 && size.height > 0;
 }
@@ -24,6 +24,22 @@
 #include <opencv2/imgproc/imgproc_c.h>
 
 #include <map>
+#include <string>
+#include <vector>
+
+#include "marker.h"
+
+#include "context.h"
+
+class RigSession;
+class MarkerTracker;
+
+// In tiled detection, markers closer than this many pixels to the edge of
+// a tile (other than the image's own edges) are left to the next tile.
+static const int TILE_EDGE_MARGIN = 32;
+
+// A page is located by at most this many markers (there are only 16).
+static const size_t MAX_PAGE_MARKERS = 16;
 
 struct LayoutInfo
 {
@@ -34,20 +50,191 @@ struct LayoutInfo
     double dpi;
 };
 
+// One page to cut out of a spread: where its markers sit on the page, and
+// how it is laid out.
+struct PageSpec
+{
+    std::map<int, CvPoint2D32f> dst_markers;
+    LayoutInfo layout;
+    std::string suffix; // Appended to the input name in batch mode.
+};
+
+struct DetectionOptions
+{
+    // Look for markers on a downscaled copy of the source image whose longer
+    // side is at most this many pixels (halving it as often as needed), and
+    // refine the corners found at full resolution. 0 to always detect at
+    // full resolution.
+    int max_detection_size;
+
+    // Follow the markers from the previous image of a sequence, searching
+    // only around where they should be now (see MarkerTracker). Not owned;
+    // NULL to search every image in full.
+    MarkerTracker *tracker;
+
+    // Buffers to detect markers in, reused from image to image. Not owned;
+    // NULL to allocate them for each image.
+    DetectionContext *context;
+
+    // Analyze the candidate markers of an image on up to this many threads
+    // (0 for one per core). Only images with many candidates (e.g., pages
+    // of printed tables) are analyzed in parallel, and never while the
+    // marker debugging window is shown.
+    int analysis_threads;
+
+    // The markers needed (bit 1 << id for each; see marker_mask). Once all
+    // of them have been found, clearly, the remaining candidates aren't
+    // analyzed; candidates that look most like markers are analyzed first.
+    // 0 to analyze every candidate.
+    unsigned int required_markers;
+
+    // When searching a whole image whose grayscale and thresholded copies
+    // would take more than this many bytes, search it tile by tile instead,
+    // keeping those copies within this budget (tiles then take the place of
+    // max_detection_size; they're searched on analysis_threads threads, each
+    // with its share of the budget, so fewer threads are used if the budget
+    // can't hold a tile for each; see minimum_tile_memory). 0 to always
+    // search the image at once.
+    size_t tile_memory;
+
+    // How much neighbouring tiles overlap, in pixels. Markers are only taken
+    // from well inside a tile, so this must exceed the size of the largest
+    // marker by 2 * TILE_EDGE_MARGIN.
+    int tile_overlap;
+
+    DetectionOptions()
+        : max_detection_size(0), tracker(NULL), context(NULL),
+        analysis_threads(1), required_markers(0), tile_memory(0),
+        tile_overlap(640) {}
+};
+
 class BookImage
 {
 private:
-    IplImage *src_img;
-    std::map<int, CvPoint2D32f> src_markers;
+    const IplImage *src_img; // Not owned; NULL until a preview gets its source.
+    const IplImage *preview_img; // Not owned; NULL unless built from a preview.
+    std::map<int, MarkerCorners> src_markers;
+    std::map<int, double> src_confidences; // Of the markers read just now.
+    RigSession *session;
+    unsigned long session_generation; // 0 unless src_markers is cached.
+    ImageStats *stats; // Not owned; NULL unless stats are being collected.
+    int analysis_threads;
+    unsigned int required_markers;
+
+    void detect_markers(const IplImage *gray_img,
+            const DetectionOptions &options, DetectionContext &context);
+    bool track_markers(const IplImage *gray_img,
+            const std::map<int, MarkerCorners> &predicted_markers,
+            DetectionContext &context);
+    void search_region(const IplImage *gray_img, const IplImage *detect_img,
+            CvRect region, int scale, DetectionContext &context);
+    void search_thresholded(const IplImage *gray_img, IplImage *bw_img,
+            CvPoint offset, int scale, DetectionContext &context);
+    void find_candidates(const IplImage *gray_img, IplImage *bw_img,
+            CvPoint offset, int scale, DetectionContext &context,
+            int threads, unsigned int required);
+    void merge_candidates(const std::vector<MarkerCandidate> &candidates);
+    void detect_tiled(const IplImage *img, const DetectionOptions &options);
+    void search_tile(const IplImage *img, CvRect tile,
+            DetectionContext &context, std::vector<MarkerCandidate> &found);
+    bool verify_markers(const IplImage *gray_img,
+            const std::map<int, MarkerCorners> &cached_markers,
+            double tolerance, std::map<int, MarkerCorners> &verified_markers);
+    bool find_page_points(const std::map<int, CvPoint2D32f> &dst_markers,
+            const LayoutInfo *layout, CvMat *src_points,
+            CvMat *dst_points) const;
+    void warp_page(const CvMat *src_points, const CvMat *dst_points,
+            IplImage *dst_image) const;
 
 public:
-    BookImage(const IplImage *src_img);
+    // Find the markers in src_img, which must stay alive as long as the
+    // BookImage (it is not copied). If a session is given, the markers it
+    // remembers from earlier images are checked first, and full detection
+    // only runs if they've moved (see RigSession).
+    //
+    // src_img can also be a single-channel "preview" of the real image (see
+    // load_preview_image), for finding markers cheaply; pages can only be
+    // rendered once the full-size color image is given to set_source_image.
+    //
+    // If stats is given, the time spent in each stage of detection and page
+    // rendering, and what became of each contour, is added to it; it must
+    // stay alive as long as the BookImage.
+    BookImage(const IplImage *src_img,
+            const DetectionOptions &options = DetectionOptions(),
+            RigSession *session = NULL, ImageStats *stats = NULL);
+
+    // Take the markers of src_img as already known (e.g., from a sidecar
+    // written when it was processed before; see MarkerSidecar), instead of
+    // finding them.
+    BookImage(const IplImage *src_img,
+            const std::map<int, MarkerCorners> &known_markers,
+            ImageStats *stats = NULL);
     ~BookImage();
+
+    // The markers found, by ID, with their corners in src_img.
+    const std::map<int, MarkerCorners> &markers() const { return src_markers; }
+
+    // How clearly each marker was read (see analyze_marker), by ID. Markers
+    // that weren't read in this image (e.g., whose position was checked
+    // against a RigSession's, or given) have none.
+    const std::map<int, double> &confidences() const { return src_confidences; }
+
+    // Whether every marker a page needs was found.
+    bool has_markers(const std::map<int, CvPoint2D32f> &dst_markers) const;
+
+    // Give a BookImage built from a preview its full-size color image, which
+    // must stay alive as long as the BookImage. The markers' corners are
+    // scaled up to it and refined there (in context's buffers, if given).
+    void set_source_image(const IplImage *full_img,
+            DetectionContext *context = NULL);
+
+    // Pages only read the BookImage, so these can be called from several
+    // threads at once.
     IplImage *create_page_image(const std::map<int, CvPoint2D32f> &dst_markers,
-            CvSize dst_size);
+            CvSize dst_size) const;
     IplImage *create_page_image(
             const std::map<int, CvPoint2D32f> &dst_markers,
-            const LayoutInfo &layout);
+            const LayoutInfo &layout) const;
+
+    // Render a page into dst_img, which must be page_image_size(layout)
+    // and 3-channel; this allocates nothing. Returns false (leaving dst_img
+    // untouched) if the page's markers weren't found.
+    bool render_page_image(const std::map<int, CvPoint2D32f> &dst_markers,
+            const LayoutInfo &layout, IplImage *dst_img) const;
+
+    // Render all the given pages in parallel, one thread per page, and
+    // return them in the same order (NULL for pages whose markers weren't
+    // found). If output_paths is not empty, each page is also saved to the
+    // matching path on its thread; an empty path skips saving that page. If
+    // a renderer is given, the pages come from (and should be recycled to)
+    // its pool.
+    std::vector<IplImage *> create_page_images(
+            const std::vector<PageSpec> &pages,
+            const std::vector<std::string> &output_paths
+                = std::vector<std::string>(),
+            PageRenderer *renderer = NULL) const;
 };
 
+// The size, in pixels, of a page with the given layout.
+CvSize page_image_size(const LayoutInfo &layout);
+
+// The IDs of the markers that locate the given pages, as a bit mask (bit
+// 1 << id for each), for DetectionOptions::required_markers.
+unsigned int marker_mask(const std::vector<PageSpec> &pages);
+
+// The smallest DetectionOptions::tile_memory that tiles with the given
+// overlap fit in, per thread searching them: a tile is at least twice the
+// overlap across, with a grayscale and a thresholded copy of it.
+size_t minimum_tile_memory(int tile_overlap);
+
+// Load an image for marker detection only: as grayscale, and reduced to
+// 1/scale of its size (scale can be 1, 2, 4 or 8), which JPEG images can be
+// decoded to directly, at a fraction of the cost of a full-size color decode.
+// Returns NULL if the image couldn't be loaded.
+IplImage *load_preview_image(const char *path, int scale);
+
+// Read the size of a JPEG or PNG image from its header, without decoding it.
+// Returns false for other formats, or if the header can't be read.
+bool read_image_size(const char *path, CvSize &size);
+
 #endif
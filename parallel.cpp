@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct ParallelJob {
+    const std::function<void(int)> *body;
+    int count;
+    std::atomic<int> next;
+
+    // Guarded by the pool mutex.
+    int helpers_wanted;
+    int helpers_active;
+    std::condition_variable helpers_done;
+
+    void work()
+    {
+        for (int i = next++; i < count; i = next++) {
+            (*body)(i);
+        }
+    }
+};
+
+class ThreadPool {
+private:
+    std::mutex mutex;
+    std::condition_variable job_available;
+    std::deque<ParallelJob*> jobs;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            job_available.wait(lock, [&] {
+                return stopping || !jobs.empty();
+            });
+            if (stopping) {
+                return;
+            }
+
+            ParallelJob *job = jobs.front();
+            job->helpers_active++;
+            if (--job->helpers_wanted == 0) {
+                jobs.pop_front();
+            }
+
+            lock.unlock();
+            job->work();
+            lock.lock();
+
+            if (--job->helpers_active == 0) {
+                job->helpers_done.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool() : stopping(false)
+    {
+        unsigned int cores = std::max(1u,
+                std::thread::hardware_concurrency());
+        for (unsigned int t = 1; t < cores; t++) {
+            threads.push_back(std::thread(&ThreadPool::worker, this));
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_available.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    // Started on first use (and thread-safely so, as a function-local
+    // static).
+    static ThreadPool &instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    int size() const
+    {
+        return static_cast<int>(threads.size());
+    }
+
+    void run(ParallelJob &job)
+    {
+        int helpers_wanted = job.helpers_wanted;
+        if (helpers_wanted > 0) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(&job);
+            }
+            if (helpers_wanted == 1) {
+                job_available.notify_one();
+            } else {
+                job_available.notify_all();
+            }
+        }
+
+        // The calling thread does its share too.
+        job.work();
+
+        // All items are taken; withdraw the job so no more helpers join
+        // it, and wait for the ones still running an item.
+        std::unique_lock<std::mutex> lock(mutex);
+        std::deque<ParallelJob*>::iterator it
+                = std::find(jobs.begin(), jobs.end(), &job);
+        if (it != jobs.end()) {
+            jobs.erase(it);
+        }
+        job.helpers_done.wait(lock, [&] {
+            return job.helpers_active == 0;
+        });
+    }
+};
+
+}
+
+void parallel_for(int count, int max_threads,
+        const std::function<void(int)> &body)
+{
+    if (count <= 0) {
+        return;
+    }
+    if (max_threads <= 0) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int number_of_threads = std::min(count, max_threads);
+    if (number_of_threads <= 1) {
+        for (int i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    ThreadPool &pool = ThreadPool::instance();
+    ParallelJob job;
+    job.body = &body;
+    job.count = count;
+    job.next = 0;
+    job.helpers_wanted = std::min(number_of_threads - 1, pool.size());
+    job.helpers_active = 0;
+    pool.run(job);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <functional>
+
+// Call body(i) for every i in [0, count), spread over up to max_threads
+// threads (including the calling one), and return once all calls are done.
+// Items are handed out one at a time, so uneven items still balance. A
+// max_threads of 0 means one thread per hardware core.
+//
+// The helper threads come from a pool with one thread per hardware core
+// (less the caller), started on the first call and kept for the life of the
+// process, so max_threads is capped at the number of cores. Calls may nest:
+// the calling thread always works on its own items, so a body that calls
+// parallel_for again finishes even when every pool thread is busy.
+void parallel_for(int count, int max_threads,
+        const std::function<void(int)> &body);
+
+#endif
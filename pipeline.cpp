@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "pipeline.h"
+#include "batch.h"
+#include "context.h"
+#include "hash.h"
+#include "parallel.h"
+#include "session.h"
+#include "sidecar.h"
+#include "tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// Everything known about one spread as it travels down the pipeline.
+struct SpreadJob
+{
+    std::string input_path;
+    IplImage *src_img; // Full-size color image.
+    IplImage *preview_img; // Reduced grayscale image, in preview mode.
+    BookImage *book_img;
+    std::vector<IplImage *> page_imgs; // One per PageSpec; NULL if not found.
+    uint64_t content_hash; // Of the input file, if it was hashed.
+    std::string cache_key; // Empty unless the cache is used.
+    bool have_sidecar; // Whether sidecar is up to date with the input.
+    MarkerSidecar sidecar;
+    ImageStats stats;
+};
+
+typedef BoundedQueue<SpreadJob *> JobQueue;
+
+// Describe everything that changes the pages cut out of a spread, for
+// result_cache_key.
+std::string cache_settings(const std::vector<PageSpec> &pages,
+        const PipelineOptions &options)
+{
+    std::ostringstream settings;
+    settings << std::setprecision(17) << "voussoir-cache 1\n";
+    for (size_t i = 0; i < pages.size(); i++) {
+        const LayoutInfo &layout = pages[i].layout;
+        settings << "page " << pages[i].suffix << " " << layout.page_left
+                << " " << layout.page_top << " " << layout.page_right
+                << " " << layout.page_bottom << " " << layout.dpi;
+        typedef std::map<int, CvPoint2D32f>::const_iterator MMCIT;
+        for (MMCIT it = pages[i].dst_markers.begin();
+                it != pages[i].dst_markers.end(); ++it) {
+            settings << " " << it->first << ":" << it->second.x << ","
+                    << it->second.y;
+        }
+        settings << "\n";
+    }
+    settings << "detection " << options.preview_scale << " "
+            << options.detection.max_detection_size << " "
+            << options.detection.tile_memory << " "
+            << options.detection.tile_overlap << "\n";
+    if (options.session != NULL) {
+        settings << "rig " << options.session->drift_tolerance() << " "
+                << options.session->redetect_every() << "\n";
+    }
+    if (options.track) {
+        settings << "track " << options.track_full_every << "\n";
+    }
+    if (options.save_markers) {
+        settings << "sidecar\n"; // Entries then hold the sidecar, too.
+    }
+    return settings.str();
+}
+
+// Where to restore a spread's cache entry to: its pages, and with
+// save_markers, its sidecar after them (see the encode stage).
+std::vector<std::string> cached_paths(const std::string &input_path,
+        const std::vector<PageSpec> &pages, const PipelineOptions &options)
+{
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < pages.size(); i++) {
+        paths.push_back(batch_output_path(options.output_dir, input_path,
+                pages[i].suffix));
+    }
+    if (options.save_markers) {
+        paths.push_back(batch_sidecar_path(options.output_dir, input_path));
+    }
+    return paths;
+}
+
+// Start `count` threads running `worker`, and close `output` once the last
+// of them has finished so that the next stage knows when to stop. The
+// threads are named after the stage in the trace, if there is one.
+template <typename Worker>
+void start_stage(std::vector<std::thread> &threads, int count,
+        const char *name, Tracer *tracer, JobQueue &output, Worker worker)
+{
+    std::shared_ptr<std::atomic<int> > remaining(
+            new std::atomic<int>(count > 0 ? count : 1));
+    for (int i = 0; i < (count > 0 ? count : 1); i++) {
+        threads.push_back(std::thread([&output, worker, remaining, name,
+                tracer, i] {
+            if (tracer != NULL) {
+                std::ostringstream thread_name;
+                thread_name << name << " " << i + 1;
+                tracer->name_thread(thread_name.str());
+            }
+            worker();
+            if (--*remaining == 0) {
+                output.close();
+            }
+        }));
+    }
+}
+
+}
+
+int run_pipeline(const std::vector<std::string> &input_paths,
+        const std::vector<PageSpec> &pages,
+        const PipelineOptions &options)
+{
+    JobQueue paths_queue(options.queue_depth);
+    JobQueue decoded_queue(options.queue_depth);
+    JobQueue detected_queue(options.queue_depth);
+    JobQueue warped_queue(options.queue_depth);
+    std::atomic<int> number_of_failures(0);
+    std::atomic<int> images_tracked(0);
+    std::atomic<int> images_searched(0);
+    std::atomic<int> images_cached(0);
+    std::vector<std::thread> threads;
+    std::string settings = cache_settings(pages, options);
+
+    // The pages are rendered into pooled images, which the encode stage
+    // hands back once they've been saved.
+    PageRenderer renderer(2 * pages.size() * (options.queue_depth + 1));
+
+    // Stats are only collected if they'll be written or traced.
+    auto stats_for = [&options](SpreadJob *job) {
+        return (options.stats_writer != NULL || options.tracer != NULL)
+                ? &job->stats : NULL;
+    };
+
+    // Decode: load each input image from disk (only as a grayscale preview,
+    // in preview mode). In render-only mode, images whose sidecars are up to
+    // date are loaded in full straight away, as they needn't be searched.
+    // Spreads whose pages are in the cache go no further.
+    start_stage(threads, options.decode_threads, "decode", options.tracer,
+            decoded_queue, [&] {
+        SpreadJob *job;
+        while (paths_queue.pop(job)) {
+            if (options.save_markers || options.render_only
+                    || options.cache != NULL) {
+                StatsTimer timer(stats_for(job), STATS_LOAD);
+                if (!hash_file(job->input_path, job->content_hash)) {
+                    std::cerr << "Error: Failed to load the source image specified ("
+                            << job->input_path << ")." << std::endl;
+                    number_of_failures++;
+                    delete job;
+                    continue;
+                }
+            }
+            if (options.cache != NULL) {
+                job->cache_key = result_cache_key(job->content_hash, settings);
+                if (options.cache->restore(job->cache_key, cached_paths(
+                        job->input_path, pages, options))) {
+                    images_cached++;
+                    if (options.verbose) {
+                        std::ostringstream message;
+                        message << "Unchanged: " << job->input_path << "\n";
+                        std::cout << message.str() << std::flush;
+                    }
+                    delete job;
+                    continue;
+                }
+            }
+            if (options.render_only) {
+                job->have_sidecar = read_current_marker_sidecar(
+                        batch_sidecar_path(options.output_dir, job->input_path),
+                        job->content_hash, job->sidecar);
+                if (!job->have_sidecar) {
+                    std::ostringstream message;
+                    message << "No up-to-date markers for " << job->input_path
+                            << "; searching it again.\n";
+                    std::cout << message.str() << std::flush;
+                }
+            }
+            {
+                StatsTimer timer(stats_for(job), STATS_LOAD);
+                if (options.preview_scale > 1 && !job->have_sidecar) {
+                    job->preview_img = load_preview_image(
+                            job->input_path.c_str(), options.preview_scale);
+                } else {
+                    job->src_img = cvLoadImage(job->input_path.c_str());
+                }
+            }
+            if (job->src_img == NULL && job->preview_img == NULL) {
+                std::cerr << "Error: Failed to load the source image specified ("
+                        << job->input_path << ")." << std::endl;
+                number_of_failures++;
+                delete job;
+                continue;
+            }
+            if (job->have_sidecar && (job->src_img->width != job->sidecar.width
+                    || job->src_img->height != job->sidecar.height)) {
+                std::ostringstream message;
+                message << "The markers saved for " << job->input_path
+                        << " are for an image of another size; searching it again.\n";
+                std::cout << message.str() << std::flush;
+                job->have_sidecar = false;
+            }
+            decoded_queue.push(job);
+        }
+    });
+
+    // Detect: find the glyphs in the spread. In preview mode, spreads in
+    // which no page has all its glyphs go no further, so they never cost a
+    // full-size decode.
+    start_stage(threads, options.detect_threads, "detect", options.tracer,
+            detected_queue, [&] {
+        // Each detect thread follows the markers through the images it gets
+        // (consecutive ones, with a single detect thread), and reuses the
+        // same detection buffers for all of them.
+        MarkerTracker tracker(options.track_full_every);
+        DetectionContext context;
+        DetectionOptions detection = options.detection;
+        detection.context = &context;
+        if (options.track) {
+            detection.tracker = &tracker;
+        }
+
+        SpreadJob *job;
+        while (decoded_queue.pop(job)) {
+            if (job->have_sidecar) {
+                job->book_img = new BookImage(job->src_img,
+                        job->sidecar.markers, stats_for(job));
+            } else if (job->preview_img != NULL) {
+                job->book_img = new BookImage(job->preview_img,
+                        detection, options.session, stats_for(job));
+
+                bool any_page_found = false;
+                for (size_t i = 0; i < pages.size(); i++) {
+                    any_page_found = any_page_found
+                            || job->book_img->has_markers(pages[i].dst_markers);
+                }
+                if (!any_page_found) {
+                    std::ostringstream message;
+                    message << "No page's glyphs were found in "
+                            << job->input_path << "; skipping it.\n";
+                    std::cout << message.str() << std::flush;
+                    if (options.stats_writer != NULL) {
+                        options.stats_writer->write(job->input_path, job->stats);
+                    }
+                    delete job->book_img;
+                    cvReleaseImage(&job->preview_img);
+                    delete job;
+                    continue;
+                }
+            } else {
+                job->book_img = new BookImage(job->src_img, detection,
+                        options.session, stats_for(job));
+            }
+            detected_queue.push(job);
+        }
+
+        images_tracked += tracker.images_tracked();
+        images_searched += tracker.images_searched();
+    });
+
+    // Warp: de-keystone and crop each requested page (after decoding the
+    // full-size image, in preview mode).
+    start_stage(threads, options.warp_threads, "warp", options.tracer,
+            warped_queue, [&] {
+        DetectionContext context;
+        SpreadJob *job;
+        while (detected_queue.pop(job)) {
+            if (job->preview_img != NULL) {
+                {
+                    StatsTimer timer(stats_for(job), STATS_LOAD);
+                    job->src_img = cvLoadImage(job->input_path.c_str());
+                }
+                if (job->src_img != NULL) {
+                    job->book_img->set_source_image(job->src_img, &context);
+                } else {
+                    std::cerr << "Error: Failed to load the source image specified ("
+                            << job->input_path << ")." << std::endl;
+                    number_of_failures++;
+                }
+                cvReleaseImage(&job->preview_img);
+            }
+            // (Spreads in which nothing was found get no sidecar, so that
+            // they'll be searched again.)
+            if (options.save_markers && !job->have_sidecar
+                    && job->src_img != NULL
+                    && !job->book_img->markers().empty()) {
+                MarkerSidecar sidecar;
+                sidecar.content_hash = job->content_hash;
+                sidecar.width = job->src_img->width;
+                sidecar.height = job->src_img->height;
+                sidecar.markers = job->book_img->markers();
+                if (!write_marker_sidecar(batch_sidecar_path(
+                        options.output_dir, job->input_path), sidecar)) {
+                    std::cerr << "Warning: Failed to save the markers of "
+                            << job->input_path << "." << std::endl;
+                }
+            }
+            job->page_imgs = job->book_img->create_page_images(pages,
+                    std::vector<std::string>(), &renderer);
+            delete job->book_img;
+            job->book_img = NULL;
+            if (job->src_img != NULL) {
+                cvReleaseImage(&job->src_img);
+            }
+            warped_queue.push(job);
+        }
+    });
+
+    // Encode: save the pages. The last stage has no queue to close after it,
+    // so it closes a dummy one.
+    JobQueue finished_queue(1);
+    start_stage(threads, options.encode_threads, "encode", options.tracer,
+            finished_queue, [&] {
+        SpreadJob *job;
+        while (warped_queue.pop(job)) {
+            // The paths of the pages saved, for the cache (which only takes
+            // spreads whose pages were all saved, so that failures are tried
+            // again next time).
+            std::vector<std::string> output_paths(pages.size());
+            bool all_saved = true;
+            bool any_saved = false;
+            for (size_t i = 0; i < pages.size(); i++) {
+                if (job->page_imgs[i] == NULL) {
+                    continue;
+                }
+                StatsTimer timer(stats_for(job), STATS_SAVE);
+                output_paths[i] = batch_output_path(options.output_dir,
+                        job->input_path, pages[i].suffix);
+                // The old page may be a hard link into the cache: remove it
+                // rather than write through it into the cache entry.
+                std::remove(output_paths[i].c_str());
+                all_saved = cvSaveImage(output_paths[i].c_str(),
+                        job->page_imgs[i]) != 0 && all_saved;
+                any_saved = true;
+                renderer.recycle(job->page_imgs[i]);
+            }
+            if (options.cache != NULL && all_saved && any_saved
+                    && !job->cache_key.empty()) {
+                // With save_markers, the entry holds the sidecar too (which
+                // spreads with pages always have), so that restoring it
+                // leaves nothing to search again in render-only mode.
+                if (options.save_markers) {
+                    output_paths.push_back(batch_sidecar_path(
+                            options.output_dir, job->input_path));
+                }
+                options.cache->store(job->cache_key, output_paths);
+            }
+            if (options.stats_writer != NULL) {
+                options.stats_writer->write(job->input_path, job->stats);
+            }
+            if (options.verbose) {
+                std::ostringstream message;
+                message << "Finished " << job->input_path << "\n";
+                std::cout << message.str() << std::flush;
+            }
+            delete job;
+        }
+    });
+
+    // Feed the pipeline from this thread; push() blocks whenever the decode
+    // stage falls behind.
+    for (size_t i = 0; i < input_paths.size(); i++) {
+        SpreadJob *job = new SpreadJob();
+        job->input_path = input_paths[i];
+        job->src_img = NULL;
+        job->preview_img = NULL;
+        job->book_img = NULL;
+        job->content_hash = 0;
+        job->have_sidecar = false;
+        job->page_imgs.resize(pages.size(), NULL);
+        job->stats.trace_to(options.tracer, job->input_path);
+        paths_queue.push(job);
+    }
+    paths_queue.close();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    if (options.verbose && options.track) {
+        std::cout << "Tracking: " << images_tracked << " images were only searched around the glyphs' previous positions; "
+                << images_searched << " were searched in full." << std::endl;
+    }
+    if (options.verbose && options.cache != NULL) {
+        std::cout << "Cache: " << images_cached << " unchanged spreads were skipped." << std::endl;
+    }
+
+    return number_of_failures;
+}
+
+int run_detect_only(const std::vector<std::string> &input_paths,
+        const PipelineOptions &options, std::ostream &records)
+{
+    std::atomic<int> number_of_failures(0);
+    std::atomic<size_t> next_input(0);
+
+    // Records finished out of order wait here until those before them have
+    // been written.
+    std::mutex records_mutex;
+    std::map<size_t, std::string> waiting_records;
+    size_t next_record = 0;
+
+    int threads = options.detect_threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, static_cast<int>(input_paths.size()));
+
+    parallel_for(threads, threads, [&](int thread) {
+        if (options.tracer != NULL) {
+            std::ostringstream thread_name;
+            thread_name << "detect " << thread + 1;
+            options.tracer->name_thread(thread_name.str());
+        }
+        DetectionContext context;
+        DetectionOptions detection = options.detection;
+        detection.context = &context;
+        detection.analysis_threads = 1; // The images are in parallel already.
+        int scale = std::max(1, options.preview_scale);
+
+        size_t i;
+        while ((i = next_input++) < input_paths.size()) {
+            ImageStats stats;
+            stats.trace_to(options.tracer, input_paths[i]);
+            ImageStats *stats_for_image
+                    = (options.stats_writer != NULL || options.tracer != NULL)
+                    ? &stats : NULL;
+
+            IplImage *preview_img;
+            {
+                StatsTimer timer(stats_for_image, STATS_LOAD);
+                preview_img = load_preview_image(input_paths[i].c_str(), scale);
+            }
+
+            std::ostringstream record;
+            record << "{\"image\": " << json_quote(input_paths[i]);
+            if (preview_img == NULL) {
+                number_of_failures++;
+                record << ", \"error\": \"The image could not be loaded.\"}";
+            } else {
+                BookImage book_img(preview_img, detection, NULL,
+                        stats_for_image);
+
+                // Scale the corners up from the preview as set_source_image
+                // would (but without refining them on the full-size image),
+                // by the ratio of the sizes: a JPEG's 1/n decode is rounded
+                // up, and other formats are resized, so it isn't quite n.
+                // Only the header of the full-size image is read for its
+                // size; if that can't be done, scale is the best guess.
+                double scale_x = scale;
+                double scale_y = scale;
+                CvSize full_size;
+                if (scale > 1 && read_image_size(input_paths[i].c_str(),
+                        full_size)) {
+                    // (A decoder that turns the image upright, as EXIF
+                    // orientation asks, swaps its sides.)
+                    if ((full_size.width > full_size.height)
+                            != (preview_img->width > preview_img->height)) {
+                        std::swap(full_size.width, full_size.height);
+                    }
+                    scale_x = static_cast<double>(full_size.width)
+                            / preview_img->width;
+                    scale_y = static_cast<double>(full_size.height)
+                            / preview_img->height;
+                }
+                record << std::fixed << std::setprecision(3)
+                        << ", \"markers\": [";
+                const std::map<int, MarkerCorners> &markers = book_img.markers();
+                const std::map<int, double> &confidences
+                        = book_img.confidences();
+                typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+                for (MCCIT it = markers.begin(); it != markers.end(); ++it) {
+                    record << (it == markers.begin() ? "" : ", ")
+                            << "{\"id\": " << it->first << ", \"corners\": [";
+                    for (int k = 0; k < 4; k++) {
+                        const CvPoint2D32f &point = it->second.points[k];
+                        record << (k == 0 ? "" : ", ") << "["
+                                << (point.x + 0.5) * scale_x - 0.5 << ", "
+                                << (point.y + 0.5) * scale_y - 0.5 << "]";
+                    }
+                    record << "]";
+                    std::map<int, double>::const_iterator confidence
+                            = confidences.find(it->first);
+                    if (confidence != confidences.end()) {
+                        record << ", \"confidence\": " << confidence->second;
+                    }
+                    record << "}";
+                }
+                record << "]}";
+                cvReleaseImage(&preview_img);
+            }
+            if (options.stats_writer != NULL) {
+                options.stats_writer->write(input_paths[i], stats);
+            }
+
+            std::lock_guard<std::mutex> lock(records_mutex);
+            waiting_records[i] = record.str();
+            while (!waiting_records.empty()
+                    && waiting_records.begin()->first == next_record) {
+                records << waiting_records.begin()->second << "\n";
+                waiting_records.erase(waiting_records.begin());
+                next_record++;
+            }
+            records.flush();
+        }
+    });
+
+    return number_of_failures;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "page.h"
+#include "stats.h"
+
+// A first-in, first-out queue shared between pipeline stages. push() blocks
+// while the queue is full, so a fast stage can't run ahead of a slow one and
+// pile up decoded images in memory. pop() blocks until an item is available,
+// and returns false once the queue has been closed and drained.
+template <typename T>
+class BoundedQueue
+{
+private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+    void push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(item);
+        not_empty.notify_one();
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // Signal that no more items will be pushed.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+};
+
+struct PipelineOptions
+{
+    int decode_threads;
+    int detect_threads;
+    int warp_threads;
+    int encode_threads;
+    size_t queue_depth; // Spreads allowed to wait between two stages.
+    std::string output_dir;
+    int preview_scale; // Find glyphs on a 1/n-size grayscale decode first.
+    DetectionOptions detection;
+    RigSession *session; // NULL unless in fixed-rig mode.
+    bool track; // Follow the markers from image to image (see MarkerTracker).
+    int track_full_every; // With track, search in full at least this often.
+    StatsWriter *stats_writer; // NULL unless per-image stats are wanted.
+    Tracer *tracer; // NULL unless a timeline of the run is wanted.
+    bool save_markers; // Write a markers sidecar for each spread.
+    bool render_only; // Use the sidecars' markers where they're up to date.
+    ResultCache *cache; // NULL unless finished pages are cached.
+    bool verbose;
+};
+
+// Process every input through a decode -> detect -> warp -> encode pipeline,
+// with each stage running on its own pool of worker threads so that, e.g.,
+// decoding spread N+1 overlaps warping spread N and encoding spread N-1.
+// Returns the number of inputs that could not be loaded.
+int run_pipeline(const std::vector<std::string> &input_paths,
+        const std::vector<PageSpec> &pages,
+        const PipelineOptions &options);
+
+// Only find the markers in every input, and write what was found to records
+// as one line of JSON per input, in input order:
+//
+//     {"image": "a.jpg", "markers": [{"id": 0, "corners": [[x0, y0], ...,
+//         [x3, y3]], "confidence": 41.5}, ...]}
+//
+// (or {"image": ..., "error": ...} if it couldn't be loaded), with the corners
+// in the pixels of the full-size image (see read_image_size). Each input is
+// loaded as a grayscale preview at options.preview_scale (never in color), and
+// no pages are made. The inputs are spread over options.detect_threads threads
+// (0 for one per hardware core), each loading and searching one at a time; the
+// other stages' options, the session and tracking aren't used. Returns the
+// number of inputs that could not be loaded.
+int run_detect_only(const std::vector<std::string> &input_paths,
+        const PipelineOptions &options, std::ostream &records);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "session.h"
+
+// Whether every one of markers is where the same marker is in others, to
+// within tolerance.
+static bool same_place(const std::map<int, MarkerCorners> &markers,
+        const std::map<int, MarkerCorners> &others, double tolerance)
+{
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+    for (MCCIT it = markers.begin(); it != markers.end(); ++it) {
+        MCCIT other = others.find(it->first);
+        if (other == others.end()) {
+            return false;
+        }
+        for (int i = 0; i < 4; i++) {
+            double dx = it->second.points[i].x - other->second.points[i].x;
+            double dy = it->second.points[i].y - other->second.points[i].y;
+            if (dx * dx + dy * dy > tolerance * tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+RigSession::RigSession(int redetect_interval, double tolerance)
+    : expected_markers(0), generation(1),
+    redetect_interval(redetect_interval),
+    images_since_detection(0), tolerance(tolerance),
+    number_verified(0), number_detected(0)
+{
+}
+
+bool RigSession::begin_image(std::map<int, MarkerCorners> &cached_markers,
+        unsigned long &cached_generation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (markers.empty() || markers.size() < expected_markers
+            || (redetect_interval > 0
+                && images_since_detection >= redetect_interval)) {
+        return false;
+    }
+
+    images_since_detection++;
+    cached_markers = markers;
+    cached_generation = generation;
+    return true;
+}
+
+void RigSession::record_verified()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    number_verified++;
+}
+
+unsigned long RigSession::record_detected(
+        const std::map<int, MarkerCorners> &detected_markers)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    number_detected++;
+    images_since_detection = 0;
+    if (detected_markers.empty()) {
+        return 0;
+    }
+    if (detected_markers.size() < markers.size()
+            && same_place(detected_markers, markers, tolerance)) {
+        // The rest are only covered; verification finds them again once
+        // they aren't.
+        return 0;
+    }
+
+    // The markers (may) have moved: start over with the new ones. (If some
+    // are missing, the images are searched in full until they're back, as
+    // verifying only the ones found wouldn't notice them.)
+    expected_markers = std::max(expected_markers, detected_markers.size());
+    markers = detected_markers;
+    generation++;
+    page_warps.clear();
+    page_warp_order.clear();
+    return generation;
+}
+
+std::shared_ptr<const PageWarp> RigSession::find_page_warp(
+        unsigned long marker_generation, const std::vector<double> &key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (marker_generation != generation) {
+        return std::shared_ptr<const PageWarp>();
+    }
+    std::map<std::vector<double>, std::shared_ptr<const PageWarp> >
+            ::const_iterator it = page_warps.find(key);
+    if (it == page_warps.end()) {
+        return std::shared_ptr<const PageWarp>();
+    }
+    return it->second;
+}
+
+void RigSession::store_page_warp(unsigned long marker_generation,
+        const std::vector<double> &key,
+        const std::shared_ptr<const PageWarp> &warp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (marker_generation != generation) {
+        return;
+    }
+    if (page_warps.find(key) == page_warps.end()) {
+        page_warp_order.push_back(key);
+        if (page_warp_order.size() > MAX_SESSION_PAGE_WARPS) {
+            page_warps.erase(page_warp_order.front());
+            page_warp_order.pop_front();
+        }
+    }
+    page_warps[key] = warp;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "marker.h"
+
+// Precomputed remap tables for warping images onto one page, as made by
+// cvConvertMaps: for every page pixel, the fixed-point position in the image
+// that it comes from (CV_16SC2) and its interpolation weights (CV_16UC1).
+struct PageWarp
+{
+    CvMat *map_xy;
+    CvMat *map_alpha;
+
+    PageWarp() : map_xy(NULL), map_alpha(NULL) {}
+    ~PageWarp()
+    {
+        cvReleaseMat(&map_xy);
+        cvReleaseMat(&map_alpha);
+    }
+
+private:
+    PageWarp(const PageWarp &);
+    PageWarp &operator=(const PageWarp &);
+};
+
+// The most remap tables a RigSession keeps at once (enough for both pages
+// of a spread, and a few other layouts).
+static const size_t MAX_SESSION_PAGE_WARPS = 4;
+
+// Remembers where the markers were found across a capture session, for rigs
+// in which the camera and platen are fixed in place. Rather than searching
+// every image for markers from scratch, BookImage first checks whether the
+// markers are still where the session says they were (which costs a few
+// reads around each marker), and only runs full detection if they aren't, or
+// every redetect_interval images. The session also keeps the remap tables
+// built from its markers for each page, since they can't change until the
+// markers do; warping a page then only costs a cvRemap. (At 600 DPI, these
+// take about 6 bytes per output pixel, e.g. some 120 MB per page.)
+//
+// A session can be shared by BookImages built on different threads.
+class RigSession
+{
+private:
+    std::mutex mutex;
+    std::map<int, MarkerCorners> markers;
+    size_t expected_markers; // How many markers the rig has in view.
+    unsigned long generation; // Changes whenever markers does; never 0.
+    int redetect_interval;
+    int images_since_detection;
+    double tolerance;
+    std::map<std::vector<double>, std::shared_ptr<const PageWarp> >
+            page_warps;
+    std::deque<std::vector<double> > page_warp_order; // Oldest first.
+    int number_verified;
+    int number_detected;
+
+public:
+    // redetect_interval: run full detection at least every this many images
+    // (0 for only when the markers have moved). tolerance: how far (in
+    // pixels) a marker corner may drift before the markers count as moved.
+    RigSession(int redetect_interval, double tolerance);
+
+    // Start a new image. Returns true, and fills in the markers to verify
+    // and their generation, if the image should be checked against the
+    // session's markers; returns false if it needs full detection.
+    bool begin_image(std::map<int, MarkerCorners> &cached_markers,
+            unsigned long &cached_generation);
+
+    double drift_tolerance() const { return tolerance; }
+    int redetect_every() const { return redetect_interval; }
+
+    // Record that an image's markers matched the session's.
+    void record_verified();
+
+    // Record the markers found by full detection, and return the generation
+    // they now belong to. If none were found, or fewer than the session has
+    // but each where the session has it (so the rest are taken to be
+    // covered, e.g. by a hand), the session keeps its markers and 0 is
+    // returned. If fewer were found and they've moved, they replace the
+    // session's, but later images are searched in full until as many
+    // markers as before are found again.
+    unsigned long record_detected(
+            const std::map<int, MarkerCorners> &detected_markers);
+
+    // Look up or store the remap tables for a page, built from the markers
+    // of the given generation. key identifies the page's geometry. Only the
+    // tables of the last MAX_SESSION_PAGE_WARPS pages stored are kept.
+    // (Tables that are in use stay valid even if the session moves on.)
+    std::shared_ptr<const PageWarp> find_page_warp(
+            unsigned long marker_generation, const std::vector<double> &key);
+    void store_page_warp(unsigned long marker_generation,
+            const std::vector<double> &key,
+            const std::shared_ptr<const PageWarp> &warp);
+
+    int images_verified() const { return number_verified; }
+    int images_detected() const { return number_detected; }
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "sidecar.h"
+
+static const char *SIDECAR_MAGIC = "voussoir-markers";
+static const int SIDECAR_VERSION = 1;
+
+bool write_marker_sidecar(const std::string &path, const MarkerSidecar &sidecar)
+{
+    // Replace the old sidecar rather than write through it, as it may be a
+    // hard link into a result cache entry.
+    std::remove(path.c_str());
+    std::ofstream file(path.c_str());
+    if (!file) {
+        return false;
+    }
+
+    // Corners are written with enough digits to be read back exactly.
+    file.precision(9);
+    file << SIDECAR_MAGIC << " " << SIDECAR_VERSION << "\n";
+    file << "hash " << std::hex << sidecar.content_hash << std::dec << "\n";
+    file << "size " << sidecar.width << " " << sidecar.height << "\n";
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+    for (MCCIT it = sidecar.markers.begin(); it != sidecar.markers.end(); ++it) {
+        file << "marker " << it->first;
+        for (int i = 0; i < 4; i++) {
+            file << " " << it->second.points[i].x << " " << it->second.points[i].y;
+        }
+        file << "\n";
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+bool read_marker_sidecar(const std::string &path, MarkerSidecar &sidecar)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        return false;
+    }
+
+    std::string magic;
+    int version;
+    if (!(file >> magic >> version) || magic != SIDECAR_MAGIC
+            || version != SIDECAR_VERSION) {
+        return false;
+    }
+
+    bool have_hash = false;
+    bool have_size = false;
+    sidecar.markers.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) {
+            continue; // Blank (e.g., the rest of the first line).
+        }
+        if (key == "hash") {
+            have_hash = static_cast<bool>(fields >> std::hex >> sidecar.content_hash);
+        } else if (key == "size") {
+            have_size = static_cast<bool>(fields >> sidecar.width >> sidecar.height);
+        } else if (key == "marker") {
+            int id;
+            MarkerCorners corners;
+            fields >> id;
+            for (int i = 0; i < 4; i++) {
+                fields >> corners.points[i].x >> corners.points[i].y;
+            }
+            if (!fields || id < 0 || id >= NUMBER_OF_MARKER_IDS) {
+                return false;
+            }
+            sidecar.markers[id] = corners;
+        } else {
+            return false;
+        }
+    }
+
+    return have_hash && have_size;
+}
+
+bool read_current_marker_sidecar(const std::string &path,
+        uint64_t content_hash, MarkerSidecar &sidecar)
+{
+    return read_marker_sidecar(path, sidecar)
+            && sidecar.content_hash == content_hash;
+}
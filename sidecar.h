@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SIDECAR_H
+#define _SIDECAR_H
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+
+#include "marker.h"
+
+// What detection found in one input image, saved next to its pages so that
+// they can be cut out again (e.g., with different offsets or DPI) without
+// finding the markers again. The sidecar is a small text file:
+//
+//     voussoir-markers 1
+//     hash 3b1f0c5e9a7d2468
+//     size 6000 4000
+//     marker 0 x0 y0 x1 y1 x2 y2 x3 y3
+//     ...
+//
+// with one line per marker, giving its corners as BookImage::markers does.
+struct MarkerSidecar
+{
+    uint64_t content_hash; // hash_file of the input image.
+    int width;
+    int height;
+    std::map<int, MarkerCorners> markers;
+};
+
+// Write a sidecar to path. Returns false if it couldn't be written.
+bool write_marker_sidecar(const std::string &path, const MarkerSidecar &sidecar);
+
+// Read the sidecar at path. Returns false if there isn't one, or it can't be
+// understood.
+bool read_marker_sidecar(const std::string &path, MarkerSidecar &sidecar);
+
+// Read the sidecar at path if it was written for an input with the given
+// content_hash. Returns false if there isn't one, it can't be understood, or
+// the input has changed since.
+bool read_current_marker_sidecar(const std::string &path,
+        uint64_t content_hash, MarkerSidecar &sidecar);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "stats.h"
+
+static const char *timer_names[STATS_TIMER_COUNT] = {
+    "load", "detect", "gray", "pyramid", "threshold", "contours", "prune", "approx",
+    "analyze", "verify", "homography", "warp", "save"
+};
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+    "contours", "pruned", "rejected_points", "rejected_convexity", "skipped",
+    "rejected_area", "rejected_decode", "markers"
+};
+
+const char *stats_timer_name(stats_timer_t timer)
+{
+    return timer_names[timer];
+}
+
+std::string ImageStats::to_json(const std::string &image_path) const
+{
+    std::ostringstream json;
+    json << "{\"image\": " << json_quote(image_path) << ", \"ms\": {";
+    for (int i = 0; i < STATS_TIMER_COUNT; i++) {
+        char milliseconds[32];
+        snprintf(milliseconds, sizeof(milliseconds), "%.3f",
+                nanoseconds[i] / 1e6);
+        json << (i == 0 ? "" : ", ") << "\"" << timer_names[i] << "\": "
+             << milliseconds;
+    }
+    json << "}, \"counts\": {";
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        json << (i == 0 ? "" : ", ") << "\"" << counter_names[i] << "\": "
+             << counters[i];
+    }
+    json << "}}";
+    return json.str();
+}
+
+bool StatsWriter::open(const std::string &path)
+{
+    file.open(path.c_str());
+    return static_cast<bool>(file);
+}
+
+void StatsWriter::write(const std::string &image_path, const ImageStats &stats)
+{
+    std::string line = stats.to_json(image_path);
+    std::lock_guard<std::mutex> lock(mutex);
+    file << line << "\n" << std::flush;
+}
+
+std::string json_quote(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "trace.h"
+
+// The stages whose wall time is recorded for each image.
+enum stats_timer_t {
+    STATS_LOAD,       // Decoding the input image (and, in preview mode, the preview).
+    STATS_DETECT,     // Finding the markers: all of the stages below, up to VERIFY.
+    STATS_GRAY,       // Converting to grayscale.
+    STATS_PYRAMID,    // Downscaling for detection (--detection-size).
+    STATS_THRESHOLD,  // Adaptive threshold.
+    STATS_CONTOURS,   // Finding contours.
+    STATS_PRUNE,      // Ruling contours out before approximating them (see could_be_marker).
+    STATS_APPROX,     // Approximating contours with polygons.
+    STATS_ANALYZE,    // analyze_marker calls.
+    STATS_VERIFY,     // Re-reading remembered markers (--fixed-rig).
+    STATS_HOMOGRAPHY, // Finding each page's homography (or remap tables).
+    STATS_WARP,       // Warping each page.
+    STATS_SAVE,       // Encoding and saving the pages.
+    STATS_TIMER_COUNT
+};
+
+// What happened to the contours found in each image: every contour is either
+// rejected by one of the filters, in this order, or becomes a marker.
+enum stats_counter_t {
+    STATS_CONTOURS_FOUND,
+    STATS_PRUNED,             // Ruled out before approximating its polygon (see could_be_marker).
+    STATS_REJECTED_POINTS,    // Its polygon doesn't have 4 corners.
+    STATS_REJECTED_CONVEXITY, // Its polygon isn't convex.
+    STATS_SKIPPED,            // Not analyzed: the markers needed were already found.
+    STATS_REJECTED_AREA,      // Smaller than a marker can be (see analyze_marker).
+    STATS_REJECTED_DECODE,    // Its cells aren't a valid marker.
+    STATS_MARKERS_FOUND,
+    STATS_COUNTER_COUNT
+};
+
+// The name of a timer, as used in stats and trace files.
+const char *stats_timer_name(stats_timer_t timer);
+
+// Timings and counters for processing one image. Stages may run on several
+// threads at once (e.g., pages warped in parallel), so updates are atomic;
+// the times of stages that overlap add up.
+class ImageStats
+{
+private:
+    std::atomic<long long> nanoseconds[STATS_TIMER_COUNT];
+    std::atomic<long> counters[STATS_COUNTER_COUNT];
+    Tracer *span_tracer;
+    std::string image_path;
+
+    ImageStats(const ImageStats &);
+    ImageStats &operator=(const ImageStats &);
+
+public:
+    ImageStats() : span_tracer(NULL)
+    {
+        for (int i = 0; i < STATS_TIMER_COUNT; i++) {
+            nanoseconds[i] = 0;
+        }
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            counters[i] = 0;
+        }
+    }
+
+    void add_time(stats_timer_t timer, long long ns) { nanoseconds[timer] += ns; }
+    void add_count(stats_counter_t counter, long n = 1) { counters[counter] += n; }
+
+    long long time_ns(stats_timer_t timer) const { return nanoseconds[timer]; }
+    long count(stats_counter_t counter) const { return counters[counter]; }
+
+    // Also record every timed stage as a span in tracer, tagged with
+    // image_path. Call before any stage is timed.
+    void trace_to(Tracer *tracer, const std::string &image_path)
+    {
+        span_tracer = tracer;
+        this->image_path = image_path;
+    }
+    Tracer *tracer() const { return span_tracer; }
+    const std::string &image() const { return image_path; }
+
+    // One line of JSON (without a newline) describing the image.
+    std::string to_json(const std::string &image_path) const;
+};
+
+// Adds the time from its construction to its destruction to one of the
+// timers of `stats` (and to its tracer, if it has one). stats can be NULL, in
+// which case it does nothing.
+class StatsTimer
+{
+private:
+    ImageStats *stats;
+    stats_timer_t timer;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StatsTimer(ImageStats *stats, stats_timer_t timer)
+        : stats(stats), timer(timer)
+    {
+        if (stats != NULL) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~StatsTimer()
+    {
+        if (stats != NULL) {
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            stats->add_time(timer, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    end - start).count());
+            if (stats->tracer() != NULL) {
+                stats->tracer()->record(stats_timer_name(timer), stats->image(),
+                        start, end);
+            }
+        }
+    }
+};
+
+// Writes one line of JSON per image to a file (see --stats). Lines written
+// from several threads at once are never interleaved.
+class StatsWriter
+{
+private:
+    std::mutex mutex;
+    std::ofstream file;
+
+public:
+    // Returns false if the file could not be created.
+    bool open(const std::string &path);
+
+    void write(const std::string &image_path, const ImageStats &stats);
+};
+
+// Quote a string for JSON.
+std::string json_quote(const std::string &text);
+
+#endif
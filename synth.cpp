@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "stats.h"
+#include "synth.h"
+
+// Background and paper brightness.
+static const int BACKGROUND_LEVEL = 60;
+static const int PAPER_LEVEL = 235;
+
+// Draw the cells of a glyph (as packed by encode_marker) with its top left
+// corner at (x, y), on a white square with a margin of one cell.
+static void draw_cells(IplImage *img, uint64_t cells, int x, int y, int cell)
+{
+    cvRectangle(img, cvPoint(x - cell, y - cell),
+            cvPoint(x + 7 * cell - 1, y + 7 * cell - 1),
+            cvScalarAll(255), CV_FILLED);
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 6; j++) {
+            if ((cells >> (i * 6 + j)) & 1) {
+                cvRectangle(img, cvPoint(x + j * cell, y + i * cell),
+                        cvPoint(x + (j + 1) * cell - 1, y + (i + 1) * cell - 1),
+                        cvScalarAll(0), CV_FILLED);
+            }
+        }
+    }
+}
+
+// Draw glyph `id` upright at (x, y), and record its outer corners. Pixel
+// (x, y) covers [x - 0.5, x + 0.5], so the glyph's edges fall half a pixel
+// outside the pixels it covers.
+static void draw_glyph(IplImage *img, int id, int x, int y, int cell,
+        std::map<int, MarkerCorners> &markers)
+{
+    draw_cells(img, encode_marker(id), x, y, cell);
+
+    float left = x - 0.5f;
+    float top = y - 0.5f;
+    float right = x + 6 * cell - 0.5f;
+    float bottom = y + 6 * cell - 0.5f;
+    MarkerCorners &corners = markers[id];
+    corners.points[0] = cvPoint2D32f(left, top);
+    corners.points[1] = cvPoint2D32f(left, bottom);
+    corners.points[2] = cvPoint2D32f(right, bottom);
+    corners.points[3] = cvPoint2D32f(right, top);
+}
+
+static double rand_range(CvRNG *rng, double low, double high)
+{
+    return low + (high - low) * cvRandReal(rng);
+}
+
+// Scatter distractors: filled boxes, outlined boxes (which look like glyph
+// borders to the contour search), and squares of glyph-like cells that don't
+// decode to any glyph.
+static void draw_clutter(IplImage *img, int count, int cell, CvRNG *rng)
+{
+    for (int k = 0; k < count; k++) {
+        int w = static_cast<int>(rand_range(rng, 1.0, 9.0) * cell);
+        int h = static_cast<int>(rand_range(rng, 1.0, 9.0) * cell);
+        int x = cvRandInt(rng) % std::max(1, img->width - w);
+        int y = cvRandInt(rng) % std::max(1, img->height - h);
+        CvScalar color = cvScalarAll(cvRandInt(rng) % 90);
+
+        switch (k % 4) {
+        case 0:
+            cvRectangle(img, cvPoint(x, y), cvPoint(x + w, y + h), color,
+                    CV_FILLED);
+            break;
+        case 1:
+        case 2:
+            cvRectangle(img, cvPoint(x, y), cvPoint(x + w, y + h), color,
+                    std::max(1, std::min(w, h) / 6));
+            break;
+        default: {
+            int fake_cell = std::max(2, w / 6);
+            uint64_t cells;
+            marker_rotation_t rotation;
+            do {
+                // A black border around random inner cells.
+                uint64_t inner = ((uint64_t(cvRandInt(rng)) << 32)
+                        | cvRandInt(rng));
+                cells = 0;
+                for (int i = 0; i < 6; i++) {
+                    for (int j = 0; j < 6; j++) {
+                        bool border = i == 0 || i == 5 || j == 0 || j == 5;
+                        if (border || ((inner >> (i * 6 + j)) & 1)) {
+                            cells |= uint64_t(1) << (i * 6 + j);
+                        }
+                    }
+                }
+            } while (decode_marker(cells, rotation) != -1);
+            draw_cells(img, cells, x, y, fake_cell);
+            break;
+        }
+        }
+    }
+}
+
+// Darken the image linearly along a random direction, by up to `strength`.
+static void apply_lighting(IplImage *img, double strength, CvRNG *rng)
+{
+    double angle = rand_range(rng, 0.0, 2.0 * CV_PI);
+    double dx = std::cos(angle);
+    double dy = std::sin(angle);
+    double extent = std::fabs(dx) * img->width + std::fabs(dy) * img->height;
+    double origin = std::min(0.0, dx * img->width) + std::min(0.0, dy * img->height);
+
+    for (int y = 0; y < img->height; y++) {
+        uchar *row = reinterpret_cast<uchar *>(img->imageData + y * img->widthStep);
+        for (int x = 0; x < img->width; x++) {
+            double t = (dx * x + dy * y - origin) / extent;
+            double gain = 1.0 - strength * t; // Between 0 and 1.
+            for (int c = 0; c < img->nChannels; c++) {
+                uchar &value = row[x * img->nChannels + c];
+                value = static_cast<uchar>(cvRound(value * gain));
+            }
+        }
+    }
+}
+
+SynthSpread create_synthetic_spread(const SynthOptions &options, double dpi)
+{
+    SynthSpread spread;
+    CvRNG rng = cvRNG(options.seed);
+
+    int width = cvRound(std::sqrt(options.megapixels * 1e6 * options.aspect));
+    int height = cvRound(options.megapixels * 1e6 / width);
+    IplImage *flat_img = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+    cvSet(flat_img, cvScalarAll(BACKGROUND_LEVEL));
+
+    // Glyphs are a whole number of pixels per cell, so that their edges (and
+    // hence the ground truth) are exact.
+    int cell = std::max(4, width / 360);
+    int side = 6 * cell;
+
+    // Scale the pages (from glyph to glyph) to fill most of the image, with
+    // a gutter of three glyphs between them.
+    int gutter = 3 * side;
+    double pixels_per_unit = std::min(
+            (height * 0.9 - side) / options.page_height,
+            (width * 0.9 - 2 * side - gutter) / (2 * options.page_width));
+    int page_width = cvRound(options.page_width * pixels_per_unit);
+    int page_height = cvRound(options.page_height * pixels_per_unit);
+    int top = (height - page_height - side) / 2;
+    int lefts[2];
+    lefts[0] = (width - 2 * (page_width + side) - gutter) / 2;
+    lefts[1] = lefts[0] + page_width + side + gutter;
+
+    for (int p = 0; p < 2; p++) {
+        cvRectangle(flat_img, cvPoint(lefts[p] - side, top - side),
+                cvPoint(lefts[p] + page_width + 2 * side,
+                    top + page_height + 2 * side),
+                cvScalarAll(PAPER_LEVEL), CV_FILLED);
+    }
+
+    draw_clutter(flat_img, options.clutter, cell, &rng);
+
+    // Glyphs 0-3 and 4-7 go clockwise around the pages from the top left,
+    // with their rotation dots on the page corners; any others go down the
+    // gutter.
+    for (int p = 0; p < 2; p++) {
+        int xs[] = { lefts[p], lefts[p] + page_width,
+                lefts[p] + page_width, lefts[p] };
+        int ys[] = { top, top, top + page_height, top + page_height };
+        for (int c = 0; c < 4; c++) {
+            draw_glyph(flat_img, p * 4 + c, xs[c], ys[c], cell, spread.markers);
+        }
+    }
+    for (int id = 8; id < std::min(options.markers, 16); id++) {
+        draw_glyph(flat_img, id, lefts[0] + page_width + 2 * side,
+                top + (id - 7) * page_height / 9, cell, spread.markers);
+    }
+
+    // Perspective: move each corner of the image inwards by a random amount,
+    // and move the glyph corners with it.
+    if (options.perspective > 0.0) {
+        double max_shift = options.perspective * std::min(width, height);
+        CvPoint2D32f src_points[4] = {
+            cvPoint2D32f(-0.5, -0.5),
+            cvPoint2D32f(width - 0.5, -0.5),
+            cvPoint2D32f(width - 0.5, height - 0.5),
+            cvPoint2D32f(-0.5, height - 0.5)
+        };
+        const double directions[4][2] = { {1, 1}, {-1, 1}, {-1, -1}, {1, -1} };
+        CvPoint2D32f dst_points[4];
+        for (int i = 0; i < 4; i++) {
+            dst_points[i] = cvPoint2D32f(
+                    src_points[i].x + directions[i][0] * rand_range(&rng, 0.0, max_shift),
+                    src_points[i].y + directions[i][1] * rand_range(&rng, 0.0, max_shift));
+        }
+
+        double h[9];
+        CvMat h_mat = cvMat(3, 3, CV_64FC1, h);
+        cvGetPerspectiveTransform(src_points, dst_points, &h_mat);
+
+        spread.img = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+        cvWarpPerspective(flat_img, spread.img, &h_mat,
+                CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS,
+                cvScalarAll(BACKGROUND_LEVEL));
+        cvReleaseImage(&flat_img);
+
+        typedef std::map<int, MarkerCorners>::iterator MIT;
+        for (MIT it = spread.markers.begin(); it != spread.markers.end(); ++it) {
+            for (int i = 0; i < 4; i++) {
+                double x = it->second.points[i].x;
+                double y = it->second.points[i].y;
+                double w = h[6] * x + h[7] * y + h[8];
+                it->second.points[i] = cvPoint2D32f(
+                        (h[0] * x + h[1] * y + h[2]) / w,
+                        (h[3] * x + h[4] * y + h[5]) / w);
+            }
+        }
+    } else {
+        spread.img = flat_img;
+    }
+
+    if (options.lighting > 0.0) {
+        apply_lighting(spread.img, options.lighting, &rng);
+    }
+
+    if (options.blur > 0.0) {
+        cvSmooth(spread.img, spread.img, CV_GAUSSIAN, 0, 0, options.blur);
+    }
+
+    // Noise is added a row at a time, so that its 16-bit working copies stay
+    // small however large the image is.
+    if (options.noise > 0.0) {
+        CvMat *noise_row = cvCreateMat(1, width, CV_16SC3);
+        CvMat *wide_row = cvCreateMat(1, width, CV_16SC3);
+        for (int y = 0; y < height; y++) {
+            CvMat row;
+            cvGetRow(spread.img, &row, y);
+            cvRandArr(&rng, noise_row, CV_RAND_NORMAL, cvScalarAll(0),
+                    cvScalarAll(options.noise));
+            cvConvert(&row, wide_row);
+            cvAdd(wide_row, noise_row, wide_row);
+            cvConvert(wide_row, &row); // Saturates to 0-255.
+        }
+        cvReleaseMat(&wide_row);
+        cvReleaseMat(&noise_row);
+    }
+
+    // The pages, as voussoir sets them up by default.
+    const char *suffixes[] = { "left_page", "right_page" };
+    for (int p = 0; p < 2; p++) {
+        PageSpec page;
+        page.dst_markers[p * 4 + 0] = cvPoint2D32f(0.0, 0.0);
+        page.dst_markers[p * 4 + 1] = cvPoint2D32f(options.page_width, 0.0);
+        page.dst_markers[p * 4 + 2] = cvPoint2D32f(options.page_width, options.page_height);
+        page.dst_markers[p * 4 + 3] = cvPoint2D32f(0.0, options.page_height);
+        page.layout.page_left = 0.0;
+        page.layout.page_top = 0.0;
+        page.layout.page_right = options.page_width;
+        page.layout.page_bottom = options.page_height;
+        page.layout.dpi = dpi;
+        page.suffix = suffixes[p];
+        spread.pages.push_back(page);
+    }
+
+    return spread;
+}
+
+bool write_ground_truth(const std::string &path, const std::string &image_path,
+        const SynthOptions &options, const SynthSpread &spread)
+{
+    std::ofstream file(path.c_str());
+    if (!file) {
+        return false;
+    }
+
+    file.setf(std::ios::fixed);
+    file.precision(4);
+    file << "{\n"
+         << "  \"image\": " << json_quote(image_path) << ",\n"
+         << "  \"width\": " << spread.img->width << ",\n"
+         << "  \"height\": " << spread.img->height << ",\n"
+         << "  \"options\": {"
+         << "\"megapixels\": " << options.megapixels
+         << ", \"aspect\": " << options.aspect
+         << ", \"markers\": " << options.markers
+         << ", \"clutter\": " << options.clutter
+         << ", \"perspective\": " << options.perspective
+         << ", \"lighting\": " << options.lighting
+         << ", \"blur\": " << options.blur
+         << ", \"noise\": " << options.noise
+         << ", \"page_width\": " << options.page_width
+         << ", \"page_height\": " << options.page_height
+         << ", \"seed\": " << options.seed << "},\n"
+         << "  \"markers\": [";
+
+    typedef std::map<int, MarkerCorners>::const_iterator MCIT;
+    for (MCIT it = spread.markers.begin(); it != spread.markers.end(); ++it) {
+        file << (it == spread.markers.begin() ? "\n" : ",\n")
+             << "    {\"id\": " << it->first << ", \"corners\": [";
+        for (int i = 0; i < 4; i++) {
+            file << (i == 0 ? "" : ", ") << "[" << it->second.points[i].x
+                 << ", " << it->second.points[i].y << "]";
+        }
+        file << "]}";
+    }
+    file << "\n  ]\n}\n";
+
+    return static_cast<bool>(file);
+}
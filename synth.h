@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SYNTH_H
+#define _SYNTH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "marker.h"
+#include "page.h"
+
+// How to render a synthetic two-page spread. The degradations are applied in
+// the order a camera would apply them: perspective, lighting, blur, noise.
+struct SynthOptions
+{
+    double megapixels;   // Size of the spread image.
+    double aspect;       // Its width divided by its height.
+    int markers;         // Glyphs to draw, 8 to 16; 0-7 frame the two pages.
+    int clutter;         // Dark distractor shapes, some of them glyph-like.
+    double perspective;  // Largest inward shift of each image corner, as a
+                         // fraction of the image's shorter side.
+    double lighting;     // Darkening across the image, from 0 (even) to 1.
+    double blur;         // Sigma of the Gaussian blur, in pixels; 0 for none.
+    double noise;        // Standard deviation of the noise, in gray levels.
+    double page_width;   // Distance between the page glyphs, in the units
+    double page_height;  // of voussoir's --page-width and --page-height.
+    unsigned int seed;
+
+    SynthOptions()
+        : megapixels(12.0), aspect(1.5), markers(8), clutter(0),
+          perspective(0.0), lighting(0.0), blur(0.0), noise(0.0),
+          page_width(6.0), page_height(9.5), seed(1) {}
+};
+
+// A rendered spread, with the exact position of every glyph in it.
+struct SynthSpread
+{
+    IplImage *img; // 8-bit, 3 channels; owned by the caller.
+
+    // The glyphs' outer corners, in image pixels, starting from the corner
+    // with the rotation dot and in the same order as analyze_marker gives
+    // them.
+    std::map<int, MarkerCorners> markers;
+
+    // The left and right pages, set up as voussoir sets them up by default
+    // (glyphs 0-3 and 4-7, page_width by page_height apart), at `dpi`.
+    std::vector<PageSpec> pages;
+};
+
+// Render a spread. The same options always give the same image.
+SynthSpread create_synthetic_spread(const SynthOptions &options,
+        double dpi = 300.0);
+
+// Write the ground truth for a spread saved at image_path as JSON: the image's
+// size, the options it was rendered with, and the corners of each glyph.
+// Returns false if the file could not be written.
+bool write_ground_truth(const std::string &path, const std::string &image_path,
+        const SynthOptions &options, const SynthSpread &spread);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/////////////////////////////////////////////
+// Render synthetic two-page spreads, with the exact positions of their glyphs,
+// for benchmarking and for measuring how accurately glyphs are found.
+/////////////////////////////////////////////
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <docopt-0.6.2/docopt.h> // For parsing command line arguments.
+
+#include "synth.h"
+
+static const char USAGE[] =
+R"(voussoir_synth.
+    Description:
+      Renders synthetic two-page spreads with voussoir's glyphs around the pages, optionally degraded by perspective, uneven lighting, blur, noise and clutter, and writes the exact corners of every glyph next to each image (in "<output_image>.json").
+
+    Usage:
+      voussoir_synth [options] <output_image>
+      voussoir_synth (-h | --help)
+
+    Options:
+      -h --help  Show this screen.
+      --megapixels=<megapixels>  The size of the spread image. [default: 12]
+      --aspect=<aspect>  The width of the spread image divided by its height. [default: 1.5]
+      --markers=<markers>  The number of glyphs to draw (8 to 16). Glyphs 0-3 and 4-7 go around the left and right pages; any others go down the gutter. [default: 8]
+      --clutter=<clutter>  The number of dark distractor shapes to scatter over the spread, some of them glyph-like. [default: 0]
+      --perspective=<perspective>  How far each image corner may be pulled in, as a fraction of the shorter side of the image. [default: 0]
+      --lighting=<lighting>  How much darker one side of the image is than the other (0 to 1). [default: 0]
+      --blur=<blur>  The sigma of the Gaussian blur, in pixels. [default: 0]
+      --noise=<noise>  The standard deviation of the added noise, in gray levels. [default: 0]
+      -w --page-width=<page_width>  The distance between glyphs across each page, as passed to voussoir. [default: 6.0]
+      -t --page-height=<page_height>  The distance between glyphs down each page, as passed to voussoir. [default: 9.5]
+      --seed=<seed>  The random seed; the same options and seed always give the same image. [default: 1]
+      --count=<count>  The number of spreads to render, with seeds counting up from --seed, named "<output_name>-0001.<ext>" etc. [default: 1]
+)";
+
+int main(int argc, const char** argv)
+{
+    std::map<std::string, docopt::value> args
+        = docopt::docopt(USAGE, { argv + 1, argv + argc }, true);
+
+    SynthOptions options;
+    options.megapixels = stod(args["--megapixels"].asString());
+    options.aspect = stod(args["--aspect"].asString());
+    options.markers = stoi(args["--markers"].asString());
+    options.clutter = stoi(args["--clutter"].asString());
+    options.perspective = stod(args["--perspective"].asString());
+    options.lighting = stod(args["--lighting"].asString());
+    options.blur = stod(args["--blur"].asString());
+    options.noise = stod(args["--noise"].asString());
+    options.page_width = stod(args["--page-width"].asString());
+    options.page_height = stod(args["--page-height"].asString());
+    unsigned int first_seed = static_cast<unsigned int>(stoul(args["--seed"].asString()));
+    int count = stoi(args["--count"].asString());
+
+    std::string output_path = args["<output_image>"].asString();
+
+    for (int i = 0; i < count; i++) {
+        options.seed = first_seed + i;
+
+        std::string image_path = output_path;
+        if (count > 1) {
+            std::ostringstream numbered;
+            size_t dot = output_path.find_last_of('.');
+            size_t slash = output_path.find_last_of('/');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+                dot = output_path.size();
+            }
+            numbered << output_path.substr(0, dot) << "-";
+            numbered.width(4);
+            numbered.fill('0');
+            numbered << i + 1;
+            numbered << output_path.substr(dot);
+            image_path = numbered.str();
+        }
+
+        SynthSpread spread = create_synthetic_spread(options);
+
+        bool saved = cvSaveImage(image_path.c_str(), spread.img) != 0;
+        bool truth_written = saved
+            && write_ground_truth(image_path + ".json", image_path, options, spread);
+        cvReleaseImage(&spread.img);
+        if (!saved) {
+            std::cerr << "Error: Failed to save the image (" << image_path << ")." << std::endl;
+            return 1;
+        }
+        if (!truth_written) {
+            std::cerr << "Error: Failed to write the ground truth (" << image_path << ".json)." << std::endl;
+            return 1;
+        }
+
+        std::cout << image_path << std::endl;
+    }
+
+    return 0;
+}
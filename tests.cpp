@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/////////////////////////////////////////////
+// Checks of the parts of voussoir that promise to give exactly what
+// something else gives: OpenCV (for the thresholding and the page warp), or
+// themselves (for the glyph codes, and the files written for later runs).
+// Run by ctest; each failed check is printed, and the exit status is the
+// number of them.
+/////////////////////////////////////////////
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "cache.h"
+#include "hash.h"
+#include "marker.h"
+#include "sidecar.h"
+#include "threshold.h"
+#include "warp.h"
+
+static int number_of_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " \
+                    << #condition << std::endl; \
+            number_of_failures++; \
+        } \
+    } while (0)
+
+// A 3-channel test image with edges, gradients and noise, like a page.
+static IplImage *create_test_image(CvSize size, int seed)
+{
+    IplImage *img = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    CvRNG rng = cvRNG(seed);
+    cvRandArr(&rng, img, CV_RAND_UNI, cvScalarAll(0), cvScalarAll(256));
+    for (int i = 0; i < 40; i++) {
+        CvPoint corner = cvPoint(cvRandInt(&rng) % size.width,
+                cvRandInt(&rng) % size.height);
+        int side = 4 + cvRandInt(&rng) % 60;
+        cvRectangle(img, corner, cvPoint(corner.x + side, corner.y + side),
+                cvScalarAll(cvRandInt(&rng) % 256), CV_FILLED);
+    }
+    cvSmooth(img, img, CV_GAUSSIAN, 3, 3);
+    return img;
+}
+
+static void test_marker_codes()
+{
+    // Every glyph decodes as itself, upright and turned each way.
+    for (int id = 0; id < NUMBER_OF_MARKER_IDS; id++) {
+        uint64_t cells = encode_marker(id);
+        CHECK(cells != 0);
+        for (int turns = 0; turns < 4; turns++) {
+            marker_rotation_t rotation;
+            CHECK(decode_marker(cells, rotation) == id);
+            if (turns == 0) {
+                CHECK(rotation == MARKER_ROT_0_DEG);
+            }
+
+            // Turn the cells a quarter clockwise.
+            uint64_t turned = 0;
+            for (int i = 0; i < 6; i++) {
+                for (int j = 0; j < 6; j++) {
+                    if ((cells >> (i * 6 + j)) & 1) {
+                        turned |= uint64_t(1) << (j * 6 + (5 - i));
+                    }
+                }
+            }
+            cells = turned;
+        }
+    }
+    marker_rotation_t rotation;
+    CHECK(decode_marker(0, rotation) == -1);
+    CHECK(encode_marker(NUMBER_OF_MARKER_IDS) == 0);
+}
+
+static void test_threshold()
+{
+    // At every block size detection uses, on an image (and a region of it,
+    // as when searching around a tracked marker), both versions of the
+    // threshold must give exactly what OpenCV does.
+    CvSize size = cvSize(211, 157);
+    IplImage *src_img = create_test_image(size, 17);
+    IplImage *gray_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *bw_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *fused_gray_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    IplImage *fused_bw_img = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    std::vector<unsigned int> sums;
+    cvCvtColor(src_img, gray_img, CV_BGR2GRAY);
+
+    for (int scale = 1; scale <= 16; scale *= 2) {
+        int block_size = threshold_block_size(scale);
+
+        cvAdaptiveThreshold(gray_img, bw_img, 128, CV_ADAPTIVE_THRESH_MEAN_C,
+                CV_THRESH_BINARY_INV, block_size, 8);
+        bgr_to_gray_threshold_mean_inv(src_img, fused_gray_img, fused_bw_img,
+                128, block_size, 8, sums);
+        CHECK(cvNorm(gray_img, fused_gray_img, CV_L1) == 0.0);
+        CHECK(cvNorm(bw_img, fused_bw_img, CV_L1) == 0.0);
+
+        cvZero(fused_bw_img);
+        threshold_mean_inv(gray_img, fused_bw_img, 128, block_size, 8, sums);
+        CHECK(cvNorm(bw_img, fused_bw_img, CV_L1) == 0.0);
+
+        CvRect region = cvRect(23, 31, 120, 90);
+        IplImage *region_bw_img = cvCreateImage(
+                cvSize(region.width, region.height), IPL_DEPTH_8U, 1);
+        IplImage *fused_region_bw_img = cvCloneImage(region_bw_img);
+        cvSetImageROI(gray_img, region);
+        cvAdaptiveThreshold(gray_img, region_bw_img, 128,
+                CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV, block_size, 8);
+        threshold_mean_inv(gray_img, fused_region_bw_img, 128, block_size, 8,
+                sums);
+        cvResetImageROI(gray_img);
+        CHECK(cvNorm(region_bw_img, fused_region_bw_img, CV_L1) == 0.0);
+        cvReleaseImage(&fused_region_bw_img);
+        cvReleaseImage(&region_bw_img);
+    }
+
+    cvReleaseImage(&fused_bw_img);
+    cvReleaseImage(&fused_gray_img);
+    cvReleaseImage(&bw_img);
+    cvReleaseImage(&gray_img);
+    cvReleaseImage(&src_img);
+}
+
+static void test_warp()
+{
+    IplImage *src_img = create_test_image(cvSize(317, 229), 2);
+    double transforms[][9] = {
+        // Slightly keystoned, as a page is.
+        { 1.05, 0.02, -6.0, -0.01, 1.04, 2.0, 2e-4, 1e-4, 1.0 },
+        // Enlarged and turned.
+        { 1.7, -0.4, 30.0, 0.35, 1.6, -45.0, -3e-4, 5e-4, 1.0 },
+        // Reduced and shifted, with black around it.
+        { 0.6, 0.05, 40.0, -0.05, 0.55, 25.0, 1e-4, -2e-4, 1.0 },
+    };
+    CvSize dst_sizes[] = { cvSize(331, 247), cvSize(203, 157) };
+
+    for (size_t t = 0; t < sizeof(transforms) / sizeof(transforms[0]); t++) {
+        CvMat h_mat = cvMat(3, 3, CV_64FC1, transforms[t]);
+        for (size_t s = 0; s < sizeof(dst_sizes) / sizeof(dst_sizes[0]); s++) {
+            IplImage *expected_img = cvCreateImage(dst_sizes[s],
+                    IPL_DEPTH_8U, 3);
+            IplImage *warped_img = cvCreateImage(dst_sizes[s],
+                    IPL_DEPTH_8U, 3);
+            cvWarpPerspective(src_img, expected_img, &h_mat);
+            for (int max_threads = 0; max_threads <= 1; max_threads++) {
+                cvSet(warped_img, cvScalarAll(77));
+                warp_perspective(src_img, warped_img, &h_mat, max_threads);
+                CHECK(cvNorm(expected_img, warped_img, CV_C) <= 1.0);
+            }
+            cvReleaseImage(&warped_img);
+            cvReleaseImage(&expected_img);
+        }
+    }
+
+    cvReleaseImage(&src_img);
+}
+
+// Write text to the file at path, replacing it.
+static void write_test_file(const std::string &path, const std::string &text)
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << text;
+}
+
+// The contents of the file at path, or "" if it can't be read.
+static std::string read_test_file(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>());
+}
+
+// Save new pages at paths, as the pipeline does: each replacing the old
+// page rather than writing over it.
+static void save_test_pages(const std::vector<std::string> &paths,
+        const std::string &text)
+{
+    for (size_t i = 0; i < paths.size(); i++) {
+        std::remove(paths[i].c_str());
+        write_test_file(paths[i], text + static_cast<char>('0' + i));
+    }
+}
+
+static void test_result_cache()
+{
+    const std::string cache_dir = "voussoir_tests_cache";
+    std::vector<std::string> output_paths;
+    output_paths.push_back("voussoir_tests_L.jpg");
+    output_paths.push_back("voussoir_tests_R.jpg");
+    const std::string key_a = result_cache_key(1, "settings a");
+    const std::string key_b = result_cache_key(1, "settings b");
+    CHECK(key_a != key_b);
+    CHECK(result_cache_key(1, "settings a") == key_a);
+
+    {
+        // Room for both entries, of 2 pages of 8 bytes.
+        ResultCache cache(cache_dir, 32);
+        CHECK(cache.open());
+
+        save_test_pages(output_paths, "pages a");
+        CHECK(!cache.restore(key_a, output_paths));
+        cache.store(key_a, output_paths);
+
+        // Restored pages come back as they were stored.
+        for (size_t i = 0; i < output_paths.size(); i++) {
+            std::remove(output_paths[i].c_str());
+        }
+        CHECK(cache.restore(key_a, output_paths));
+        CHECK(read_test_file(output_paths[0]) == "pages a0");
+        CHECK(read_test_file(output_paths[1]) == "pages a1");
+
+        // Saving different pages over restored ones (e.g., after changing
+        // the settings) leaves the entry they were restored from alone.
+        save_test_pages(output_paths, "pages b");
+        cache.store(key_b, output_paths);
+        CHECK(cache.restore(key_a, output_paths));
+        CHECK(read_test_file(output_paths[0]) == "pages a0");
+        CHECK(read_test_file(output_paths[1]) == "pages a1");
+        CHECK(cache.restore(key_b, output_paths));
+        CHECK(read_test_file(output_paths[0]) == "pages b0");
+        CHECK(read_test_file(output_paths[1]) == "pages b1");
+    }
+
+    {
+        // Reopened with room for one entry, the cache keeps one.
+        ResultCache cache(cache_dir, 16);
+        CHECK(cache.open());
+        CHECK(cache.restore(key_a, output_paths)
+                != cache.restore(key_b, output_paths));
+    }
+
+    {
+        // And with room for none, it's emptied (which cleans up, too).
+        ResultCache cache(cache_dir, 0);
+        CHECK(cache.open());
+        CHECK(!cache.restore(key_a, output_paths));
+        CHECK(!cache.restore(key_b, output_paths));
+    }
+
+    CHECK(std::remove(cache_dir.c_str()) == 0);
+    for (size_t i = 0; i < output_paths.size(); i++) {
+        std::remove(output_paths[i].c_str());
+    }
+}
+
+static void test_sidecar()
+{
+    // The files go in the working directory (the build directory, under
+    // ctest).
+    const std::string input_path = "voussoir_tests_input.jpg";
+    const std::string sidecar_path = "voussoir_tests_input.markers";
+    write_test_file(input_path, "not really a JPEG");
+
+    MarkerSidecar written;
+    CHECK(hash_file(input_path, written.content_hash));
+    written.width = 6000;
+    written.height = 4000;
+    CvRNG rng = cvRNG(7);
+    for (int id = 0; id < NUMBER_OF_MARKER_IDS; id += 3) {
+        MarkerCorners corners;
+        for (int i = 0; i < 4; i++) {
+            corners.points[i].x = static_cast<float>(cvRandReal(&rng) * 6000);
+            corners.points[i].y = static_cast<float>(cvRandReal(&rng) * 4000);
+        }
+        written.markers[id] = corners;
+    }
+    CHECK(write_marker_sidecar(sidecar_path, written));
+
+    // Read back, every corner is exactly as written.
+    MarkerSidecar read;
+    CHECK(read_current_marker_sidecar(sidecar_path, written.content_hash,
+            read));
+    CHECK(read.content_hash == written.content_hash);
+    CHECK(read.width == written.width && read.height == written.height);
+    CHECK(read.markers.size() == written.markers.size());
+    typedef std::map<int, MarkerCorners>::const_iterator MCCIT;
+    for (MCCIT it = written.markers.begin(); it != written.markers.end();
+            ++it) {
+        CHECK(read.markers.count(it->first) == 1);
+        for (int i = 0; i < 4; i++) {
+            CHECK(read.markers[it->first].points[i].x
+                    == it->second.points[i].x);
+            CHECK(read.markers[it->first].points[i].y
+                    == it->second.points[i].y);
+        }
+    }
+
+    // Once the input changes, its sidecar is no longer current.
+    write_test_file(input_path, "not really a JPEG, either");
+    uint64_t changed_hash;
+    CHECK(hash_file(input_path, changed_hash));
+    CHECK(changed_hash != written.content_hash);
+    CHECK(!read_current_marker_sidecar(sidecar_path, changed_hash, read));
+
+    // Nor is a damaged or missing sidecar read.
+    write_test_file(sidecar_path, "voussoir-markers 1\nhash 12\nbogus\n");
+    CHECK(!read_marker_sidecar(sidecar_path, read));
+    std::remove(sidecar_path.c_str());
+    CHECK(!read_marker_sidecar(sidecar_path, read));
+
+    std::remove(input_path.c_str());
+}
+
+int main()
+{
+    // (The glyph decoder would otherwise show what it reads.)
+    show_marker_debug_window = false;
+
+    test_marker_codes();
+    test_threshold();
+    test_warp();
+    test_sidecar();
+    test_result_cache();
+
+    if (number_of_failures > 0) {
+        std::cerr << number_of_failures << " checks failed." << std::endl;
+    } else {
+        std::cout << "All checks passed." << std::endl;
+    }
+    return number_of_failures;
+}
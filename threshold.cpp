@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define THRESHOLD_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define THRESHOLD_NEON
+#include <arm_neon.h>
+#endif
+
+#include "threshold.h"
+
+// OpenCV's fixed-point BGR to gray weights (0.114, 0.587 and 0.299, scaled
+// by 2^14), so that the gray values match cvCvtColor's exactly.
+static const int GRAY_SHIFT = 14;
+static const int GRAY_B = 1868;
+static const int GRAY_G = 9617;
+static const int GRAY_R = 4899;
+static const int GRAY_ROUND = 1 << (GRAY_SHIFT - 1);
+
+// The mean of a block is compared without dividing: with an odd area, the
+// rounded mean (sum + area / 2) / area is at least v exactly when
+// sum >= v * area - area / 2. So a pixel passes the threshold when its
+// block's sum is at least src * area + bias, where bias is
+// delta * area - area / 2.
+
+// For blocks of at most this many pixels, OpenCV's box filter sums in 16
+// bits and divides by a fixed-point reciprocal of the area, whose rounding
+// the comparison above doesn't reproduce; OpenCV is used for those.
+static const int MAX_OPENCV_SHORT_SUM_AREA = 256;
+
+// The per-row kernels, in one version per instruction set.
+struct ThresholdKernels
+{
+    const char *name;
+
+    // Convert a row of BGR pixels to gray.
+    void (*gray_row)(const uchar *bgr, uchar *gray, int width);
+
+    // Slide the column sums down a row: add one row and remove another.
+    void (*update_sums)(unsigned int *sums, const uchar *add_row,
+            const uchar *sub_row, int width);
+
+    // Threshold a row, given the prefix sums of its (edge-extended) column
+    // sums.
+    void (*threshold_row)(const unsigned int *prefix, const uchar *src,
+            uchar *dst, int width, int block_size, int area, int bias,
+            uchar max_value);
+};
+
+static void gray_row_scalar(const uchar *bgr, uchar *gray, int width)
+{
+    for (int x = 0; x < width; x++) {
+        const uchar *p = bgr + 3 * x;
+        gray[x] = static_cast<uchar>((p[0] * GRAY_B + p[1] * GRAY_G
+                + p[2] * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+    }
+}
+
+static void update_sums_scalar(unsigned int *sums, const uchar *add_row,
+        const uchar *sub_row, int width)
+{
+    for (int x = 0; x < width; x++) {
+        sums[x] += add_row[x];
+        sums[x] -= sub_row[x];
+    }
+}
+
+static void threshold_row_scalar(const unsigned int *prefix, const uchar *src,
+        uchar *dst, int width, int block_size, int area, int bias,
+        uchar max_value)
+{
+    for (int x = 0; x < width; x++) {
+        int sum = static_cast<int>(prefix[x + block_size] - prefix[x]);
+        dst[x] = (sum >= src[x] * area + bias) ? max_value : 0;
+    }
+}
+
+#ifdef THRESHOLD_AVX2
+
+__attribute__((target("avx2")))
+static void gray_row_avx2(const uchar *bgr, uchar *gray, int width)
+{
+    // Split 16 BGR pixels (48 bytes, in three loads) into their channels.
+    // The channel shuffles work within 128 bits, so this runs 16 pixels at
+    // a time.
+    const __m128i blue0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i blue1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i blue2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i green0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i green1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i green2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i red0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i red1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i red2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    // Each pixel is two multiply-adds of 16-bit pairs: (b, g) and (r, 1).
+    const __m128i bg_weights = _mm_setr_epi16(GRAY_B, GRAY_G, GRAY_B, GRAY_G,
+            GRAY_B, GRAY_G, GRAY_B, GRAY_G);
+    const __m128i r1_weights = _mm_setr_epi16(GRAY_R, GRAY_ROUND, GRAY_R,
+            GRAY_ROUND, GRAY_R, GRAY_ROUND, GRAY_R, GRAY_ROUND);
+    const __m128i ones = _mm_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uchar *p = bgr + 3 * x;
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+        __m128i blue = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, blue0),
+                _mm_shuffle_epi8(b, blue1)), _mm_shuffle_epi8(c, blue2));
+        __m128i green = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, green0),
+                _mm_shuffle_epi8(b, green1)), _mm_shuffle_epi8(c, green2));
+        __m128i red = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, red0),
+                _mm_shuffle_epi8(b, red1)), _mm_shuffle_epi8(c, red2));
+
+        __m128i halves[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i b16 = _mm_cvtepu8_epi16(h == 0 ? blue : _mm_srli_si128(blue, 8));
+            __m128i g16 = _mm_cvtepu8_epi16(h == 0 ? green : _mm_srli_si128(green, 8));
+            __m128i r16 = _mm_cvtepu8_epi16(h == 0 ? red : _mm_srli_si128(red, 8));
+            __m128i lo = _mm_add_epi32(
+                    _mm_madd_epi16(_mm_unpacklo_epi16(b16, g16), bg_weights),
+                    _mm_madd_epi16(_mm_unpacklo_epi16(r16, ones), r1_weights));
+            __m128i hi = _mm_add_epi32(
+                    _mm_madd_epi16(_mm_unpackhi_epi16(b16, g16), bg_weights),
+                    _mm_madd_epi16(_mm_unpackhi_epi16(r16, ones), r1_weights));
+            halves[h] = _mm_packs_epi32(_mm_srai_epi32(lo, GRAY_SHIFT),
+                    _mm_srai_epi32(hi, GRAY_SHIFT));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(gray + x),
+                _mm_packus_epi16(halves[0], halves[1]));
+    }
+    gray_row_scalar(bgr + 3 * x, gray + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void update_sums_avx2(unsigned int *sums, const uchar *add_row,
+        const uchar *sub_row, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i add = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(add_row + x)));
+        __m256i sub = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(sub_row + x)));
+        __m256i *s = reinterpret_cast<__m256i *>(sums + x);
+        _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s),
+                _mm256_sub_epi32(add, sub)));
+    }
+    update_sums_scalar(sums + x, add_row + x, sub_row + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void threshold_row_avx2(const unsigned int *prefix, const uchar *src,
+        uchar *dst, int width, int block_size, int area, int bias,
+        uchar max_value)
+{
+    const __m256i area_v = _mm256_set1_epi32(area);
+    const __m256i bias_v = _mm256_set1_epi32(bias - 1); // For sum > t - 1.
+    const __m256i max_v = _mm256_set1_epi32(max_value);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i sum = _mm256_sub_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(prefix + x + block_size)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(prefix + x)));
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(src + x)));
+        __m256i limit = _mm256_add_epi32(_mm256_mullo_epi32(pixels, area_v), bias_v);
+        __m256i result = _mm256_and_si256(_mm256_cmpgt_epi32(sum, limit), max_v);
+        __m128i result16 = _mm_packus_epi32(_mm256_castsi256_si128(result),
+                _mm256_extracti128_si256(result, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x),
+                _mm_packus_epi16(result16, result16));
+    }
+    threshold_row_scalar(prefix + x, src + x, dst + x, width - x, block_size,
+            area, bias, max_value);
+}
+
+#endif
+
+#ifdef THRESHOLD_NEON
+
+static void gray_row_neon(const uchar *bgr, uchar *gray, int width)
+{
+    const uint32x4_t round = vdupq_n_u32(GRAY_ROUND);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x3_t pixels = vld3_u8(bgr + 3 * x);
+        uint16x8_t b = vmovl_u8(pixels.val[0]);
+        uint16x8_t g = vmovl_u8(pixels.val[1]);
+        uint16x8_t r = vmovl_u8(pixels.val[2]);
+        uint32x4_t lo = vmlal_n_u16(vmlal_n_u16(vmlal_n_u16(round,
+                vget_low_u16(b), GRAY_B), vget_low_u16(g), GRAY_G),
+                vget_low_u16(r), GRAY_R);
+        uint32x4_t hi = vmlal_n_u16(vmlal_n_u16(vmlal_n_u16(round,
+                vget_high_u16(b), GRAY_B), vget_high_u16(g), GRAY_G),
+                vget_high_u16(r), GRAY_R);
+        vst1_u8(gray + x, vmovn_u16(vcombine_u16(vshrn_n_u32(lo, GRAY_SHIFT),
+                vshrn_n_u32(hi, GRAY_SHIFT))));
+    }
+    gray_row_scalar(bgr + 3 * x, gray + x, width - x);
+}
+
+static void update_sums_neon(unsigned int *sums, const uchar *add_row,
+        const uchar *sub_row, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t add = vmovl_u8(vld1_u8(add_row + x));
+        uint16x8_t sub = vmovl_u8(vld1_u8(sub_row + x));
+        // The differences wrap around when negative, as the sums do.
+        vst1q_u32(sums + x, vaddq_u32(vld1q_u32(sums + x),
+                vsubl_u16(vget_low_u16(add), vget_low_u16(sub))));
+        vst1q_u32(sums + x + 4, vaddq_u32(vld1q_u32(sums + x + 4),
+                vsubl_u16(vget_high_u16(add), vget_high_u16(sub))));
+    }
+    update_sums_scalar(sums + x, add_row + x, sub_row + x, width - x);
+}
+
+static void threshold_row_neon(const unsigned int *prefix, const uchar *src,
+        uchar *dst, int width, int block_size, int area, int bias,
+        uchar max_value)
+{
+    const int32x4_t bias_v = vdupq_n_s32(bias);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int32x4_t sum_lo = vreinterpretq_s32_u32(vsubq_u32(
+                vld1q_u32(prefix + x + block_size), vld1q_u32(prefix + x)));
+        int32x4_t sum_hi = vreinterpretq_s32_u32(vsubq_u32(
+                vld1q_u32(prefix + x + 4 + block_size), vld1q_u32(prefix + x + 4)));
+        uint16x8_t pixels = vmovl_u8(vld1_u8(src + x));
+        int32x4_t limit_lo = vmlaq_n_s32(bias_v, vreinterpretq_s32_u32(
+                vmovl_u16(vget_low_u16(pixels))), area);
+        int32x4_t limit_hi = vmlaq_n_s32(bias_v, vreinterpretq_s32_u32(
+                vmovl_u16(vget_high_u16(pixels))), area);
+        uint16x8_t passed = vcombine_u16(vmovn_u32(vcgeq_s32(sum_lo, limit_lo)),
+                vmovn_u32(vcgeq_s32(sum_hi, limit_hi)));
+        vst1_u8(dst + x, vand_u8(vmovn_u16(passed), vdup_n_u8(max_value)));
+    }
+    threshold_row_scalar(prefix + x, src + x, dst + x, width - x, block_size,
+            area, bias, max_value);
+}
+
+#endif
+
+// Pick the fastest kernels the CPU supports (once).
+static const ThresholdKernels &threshold_kernels()
+{
+    static const ThresholdKernels kernels = []() -> ThresholdKernels {
+#ifdef THRESHOLD_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            ThresholdKernels avx2 = { "avx2", gray_row_avx2,
+                    update_sums_avx2, threshold_row_avx2 };
+            return avx2;
+        }
+#endif
+#ifdef THRESHOLD_NEON
+        ThresholdKernels neon = { "neon", gray_row_neon, update_sums_neon,
+                threshold_row_neon };
+        return neon;
+#endif
+        ThresholdKernels scalar = { "scalar", gray_row_scalar,
+                update_sums_scalar, threshold_row_scalar };
+        return scalar;
+    }();
+    return kernels;
+}
+
+int threshold_block_size(int scale)
+{
+    return std::max(3, ((11+20) / scale) | 1);
+}
+
+const char *threshold_kernel_name()
+{
+    return threshold_kernels().name;
+}
+
+// The pixels of an image's ROI (or the whole image, if it has none).
+static const uchar *roi_data(const IplImage *img, CvSize &size)
+{
+    if (img->roi == NULL) {
+        size = cvSize(img->width, img->height);
+        return reinterpret_cast<const uchar *>(img->imageData);
+    }
+    size = cvSize(img->roi->width, img->roi->height);
+    return reinterpret_cast<const uchar *>(img->imageData)
+            + img->roi->yOffset * img->widthStep
+            + img->roi->xOffset * img->nChannels;
+}
+
+// Threshold a width x height image whose gray rows come from row(y), into
+// dst. row is asked for the rows in an order that only moves forward (but
+// may ask again for rows it has already given), so it can produce them as
+// it goes.
+template <typename RowSource>
+static void threshold_rows(RowSource &row, int width, int height, uchar *dst,
+        int dst_step, int max_value, int block_size, int delta,
+        std::vector<unsigned int> &sums)
+{
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    const ThresholdKernels &kernels = threshold_kernels();
+    const int radius = block_size / 2;
+    const int area = block_size * block_size;
+    const int bias = delta * area - area / 2;
+    const uchar max_byte = static_cast<uchar>(std::min(std::max(max_value, 0), 255));
+
+    // The column sums of the block around the current row, followed by the
+    // prefix sums along the row of those, extended by radius at each end.
+    // (The prefix sums may wrap around, but their differences don't.)
+    size_t needed = width + (width + 2 * radius + 1);
+    if (sums.size() < needed) {
+        sums.resize(needed);
+    }
+    unsigned int *column = &sums[0];
+    unsigned int *prefix = column + width;
+
+    // The column sums for the first row, whose block is partly above the
+    // image (where the first row is repeated).
+    std::fill(column, column + width, 0);
+    for (int dy = -radius; dy <= radius; dy++) {
+        const uchar *r = row(std::min(std::max(dy, 0), height - 1));
+        for (int x = 0; x < width; x++) {
+            column[x] += r[x];
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        if (y > 0) {
+            kernels.update_sums(column, row(std::min(y + radius, height - 1)),
+                    row(std::max(y - radius - 1, 0)), width);
+        }
+
+        unsigned int total = 0;
+        prefix[0] = 0;
+        for (int i = 0; i < radius; i++) {
+            total += column[0];
+            prefix[i + 1] = total;
+        }
+        for (int x = 0; x < width; x++) {
+            total += column[x];
+            prefix[radius + x + 1] = total;
+        }
+        for (int i = 0; i < radius; i++) {
+            total += column[width - 1];
+            prefix[radius + width + i + 1] = total;
+        }
+
+        kernels.threshold_row(prefix, row(y), dst + y * dst_step, width,
+                block_size, area, bias, max_byte);
+    }
+}
+
+void threshold_mean_inv(const IplImage *src, IplImage *dst, int max_value,
+        int block_size, int delta, std::vector<unsigned int> &sums)
+{
+    if (block_size * block_size <= MAX_OPENCV_SHORT_SUM_AREA) {
+        cvAdaptiveThreshold(src, dst, max_value, CV_ADAPTIVE_THRESH_MEAN_C,
+                CV_THRESH_BINARY_INV, block_size, delta);
+        return;
+    }
+
+    CvSize size;
+    const uchar *data = roi_data(src, size);
+    const int step = src->widthStep;
+    auto row = [data, step](int y) -> const uchar * { return data + y * step; };
+
+    threshold_rows(row, size.width, size.height,
+            reinterpret_cast<uchar *>(dst->imageData), dst->widthStep,
+            max_value, block_size, delta, sums);
+}
+
+void bgr_to_gray_threshold_mean_inv(const IplImage *src, IplImage *gray_dst,
+        IplImage *bw_dst, int max_value, int block_size, int delta,
+        std::vector<unsigned int> &sums)
+{
+    if (block_size * block_size <= MAX_OPENCV_SHORT_SUM_AREA) {
+        cvCvtColor(src, gray_dst, CV_BGR2GRAY);
+        cvAdaptiveThreshold(gray_dst, bw_dst, max_value,
+                CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV, block_size,
+                delta);
+        return;
+    }
+
+    CvSize size;
+    const uchar *data = roi_data(src, size);
+    const int step = src->widthStep;
+    uchar *gray = reinterpret_cast<uchar *>(gray_dst->imageData);
+    const int gray_step = gray_dst->widthStep;
+    const int width = size.width;
+
+    // Convert each row as the threshold first needs it, while it's still
+    // in the cache.
+    void (*gray_row)(const uchar *, uchar *, int) = threshold_kernels().gray_row;
+    int converted = 0;
+    auto row = [&](int y) -> const uchar * {
+        for (; converted <= y; converted++) {
+            gray_row(data + converted * step, gray + converted * gray_step,
+                    width);
+        }
+        return gray + y * gray_step;
+    };
+
+    threshold_rows(row, size.width, size.height,
+            reinterpret_cast<uchar *>(bw_dst->imageData), bw_dst->widthStep,
+            max_value, block_size, delta, sums);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _THRESHOLD_H
+#define _THRESHOLD_H
+
+#include <vector>
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+// Threshold an 8-bit, single-channel image (or its ROI, taken as the whole
+// image) into dst, which must be the same size: each pixel becomes
+// max_value if it's at least delta darker than the mean of the
+// block_size x block_size block around it (edges replicated), and 0
+// otherwise. The result is exactly that of
+//
+//     cvAdaptiveThreshold(src, dst, max_value, CV_ADAPTIVE_THRESH_MEAN_C,
+//             CV_THRESH_BINARY_INV, block_size, delta)
+//
+// but it's computed with running column sums, using AVX2 or NEON where the
+// CPU has them -- for blocks of more than 256 pixels (block_size 17 and up,
+// e.g. the full-resolution block of 31). OpenCV averages smaller blocks
+// with a fixed-point division that rounds some means differently, so for
+// those this just calls cvAdaptiveThreshold. block_size must be odd; sums is
+// working space, which can be reused from call to call.
+void threshold_mean_inv(const IplImage *src, IplImage *dst, int max_value,
+        int block_size, int delta, std::vector<unsigned int> &sums);
+
+// The same, for a 3-channel BGR image, fused with the conversion to
+// grayscale: gray_dst gets exactly what cvCvtColor(src, gray_dst,
+// CV_BGR2GRAY) would give, and bw_dst its threshold, in a single pass over
+// src. (For small blocks, as above, this calls cvCvtColor and
+// cvAdaptiveThreshold.)
+void bgr_to_gray_threshold_mean_inv(const IplImage *src, IplImage *gray_dst,
+        IplImage *bw_dst, int max_value, int block_size, int delta,
+        std::vector<unsigned int> &sums);
+
+// The threshold's block size for marker detection on an image downscaled by
+// scale (it shrinks with the image, down to the smallest odd block).
+int threshold_block_size(int scale);
+
+// The name of the instruction set the thresholding uses on this CPU
+// ("avx2", "neon" or "scalar").
+const char *threshold_kernel_name();
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "trace.h"
+#include "stats.h"
+
+Tracer::Tracer() : any_events(false)
+{
+}
+
+Tracer::~Tracer()
+{
+    if (file.is_open()) {
+        file << "\n]\n";
+    }
+}
+
+bool Tracer::open(const std::string &path)
+{
+    file.open(path.c_str());
+    origin = std::chrono::steady_clock::now();
+    if (file) {
+        file << "[";
+    }
+    return static_cast<bool>(file);
+}
+
+int Tracer::thread_number()
+{
+    // Each thread remembers its number in the last tracer it recorded to,
+    // so that the map is only looked up (under its lock) once per thread.
+    thread_local const Tracer *cached_tracer = NULL;
+    thread_local int cached_number = 0;
+    if (cached_tracer == this) {
+        return cached_number;
+    }
+
+    std::lock_guard<std::mutex> lock(thread_numbers_mutex);
+    std::thread::id id = std::this_thread::get_id();
+    std::map<std::thread::id, int>::iterator it = thread_numbers.find(id);
+    int number;
+    if (it != thread_numbers.end()) {
+        number = it->second;
+    } else {
+        number = thread_numbers.size() + 1;
+        thread_numbers[id] = number;
+    }
+    cached_tracer = this;
+    cached_number = number;
+    return number;
+}
+
+void Tracer::write_event(const std::string &event)
+{
+    file << (any_events ? ",\n" : "\n") << event;
+    any_events = true;
+}
+
+void Tracer::name_thread(const std::string &name)
+{
+    std::ostringstream event;
+    event << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+          << thread_number() << ", \"args\": {\"name\": " << json_quote(name)
+          << "}}";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) {
+        return;
+    }
+    write_event(event.str());
+}
+
+void Tracer::record(const char *name, const std::string &image,
+        std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end)
+{
+    // Build the event before taking the lock; only the write is serialized.
+    char times[96];
+    snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f",
+            std::chrono::duration<double, std::micro>(start - origin).count(),
+            std::chrono::duration<double, std::micro>(end - start).count());
+    std::ostringstream event;
+    event << "{\"name\": \"" << name << "\", \"cat\": \"voussoir\", \"ph\": \"X\", "
+          << times << ", \"pid\": 1, \"tid\": " << thread_number()
+          << ", \"args\": {\"image\": " << json_quote(image) << "}}";
+    std::string event_text = event.str();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) {
+        return;
+    }
+    write_event(event_text);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes spans of time to a file in the Chrome trace event format (see
+// --trace), which chrome://tracing and https://ui.perfetto.dev can show as a
+// timeline with one row per thread. Spans can be recorded from any thread.
+class Tracer
+{
+private:
+    std::mutex mutex;
+    std::ofstream file;
+    bool any_events;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex thread_numbers_mutex;
+    std::map<std::thread::id, int> thread_numbers;
+
+    int thread_number();
+    void write_event(const std::string &event); // Call with mutex held.
+
+    Tracer(const Tracer &);
+    Tracer &operator=(const Tracer &);
+
+public:
+    Tracer();
+    ~Tracer(); // Finishes the file.
+
+    // Returns false if the file could not be created.
+    bool open(const std::string &path);
+
+    // Name the calling thread's row in the timeline.
+    void name_thread(const std::string &name);
+
+    // Record that the calling thread spent from start to end on `name`,
+    // while working on `image` (which may be empty).
+    void record(const char *name, const std::string &image,
+            std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end);
+};
+
+#endif
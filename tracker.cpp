@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tracker.h"
+
+MarkerTracker::MarkerTracker(int full_search_interval)
+    : full_search_interval(full_search_interval),
+    images_since_full_search(0), number_tracked(0), number_searched(0)
+{
+}
+
+bool MarkerTracker::predict(std::map<int, MarkerCorners> &predicted_markers)
+{
+    if (last_markers.empty()
+            || (full_search_interval > 0
+                && images_since_full_search >= full_search_interval)) {
+        return false;
+    }
+
+    predicted_markers = last_markers;
+    typedef std::map<int, MarkerCorners>::iterator MIT;
+    for (MIT it = predicted_markers.begin(); it != predicted_markers.end(); ++it) {
+        std::map<int, MarkerCorners>::const_iterator pit
+                = previous_markers.find(it->first);
+        if (pit == previous_markers.end()) {
+            continue;
+        }
+        // Constant velocity: move each corner on by as much as it moved
+        // between the last two images.
+        for (int i = 0; i < 4; i++) {
+            it->second.points[i].x += it->second.points[i].x - pit->second.points[i].x;
+            it->second.points[i].y += it->second.points[i].y - pit->second.points[i].y;
+        }
+    }
+    return true;
+}
+
+void MarkerTracker::record(const std::map<int, MarkerCorners> &found_markers,
+        bool full_search)
+{
+    if (full_search) {
+        number_searched++;
+        images_since_full_search = 0;
+    } else {
+        number_tracked++;
+        images_since_full_search++;
+    }
+
+    previous_markers = last_markers;
+    last_markers = found_markers;
+}
+
+void MarkerTracker::reset()
+{
+    last_markers.clear();
+    previous_markers.clear();
+}
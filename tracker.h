@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACKER_H
+#define _TRACKER_H
+
+#include <map>
+
+#include "marker.h"
+
+// Follows the markers from one image to the next in a sequence (frames from
+// the webcam, or consecutive stills of a book), for when they move a little
+// between images but don't stay exactly in place (for that, see RigSession).
+// BookImage asks the tracker where each marker should be, and searches only
+// a small window around each prediction instead of the whole image. If any
+// predicted marker isn't found there, or every full_search_interval images
+// (so that markers coming into view are noticed), the whole image is
+// searched instead.
+//
+// Unlike a RigSession, a tracker follows one sequence of images, so it must
+// not be shared between threads (give each worker its own).
+class MarkerTracker
+{
+private:
+    std::map<int, MarkerCorners> last_markers;
+    std::map<int, MarkerCorners> previous_markers; // From the image before.
+    int full_search_interval;
+    int images_since_full_search;
+    int number_tracked;
+    int number_searched;
+
+public:
+    // full_search_interval: search the whole image at least every this many
+    // images (0 for only when a marker is lost).
+    explicit MarkerTracker(int full_search_interval);
+
+    // Predict where the markers will be in the next image, from where they
+    // were in the last two (assuming they keep moving as they did). Returns
+    // false if the whole image should be searched instead.
+    bool predict(std::map<int, MarkerCorners> &predicted_markers);
+
+    // Record the markers found in an image, and whether the whole image
+    // was searched for them.
+    void record(const std::map<int, MarkerCorners> &found_markers,
+            bool full_search);
+
+    // Forget the markers, so that the next image gets a full search.
+    void reset();
+
+    int images_tracked() const { return number_tracked; }
+    int images_searched() const { return number_searched; }
+};
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#define WARP_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WARP_NEON
+#include <arm_neon.h>
+#endif
+
+#include "parallel.h"
+#include "warp.h"
+
+// Source positions are rounded to 1/32 pixel, as OpenCV's INTER_BITS, and
+// the bilinear weights of a position are the products of its horizontal and
+// vertical weights out of 32. (OpenCV scales its weights to 2^15 rather than
+// 2^10, but they're the same products times 32, so the results are the
+// same.)
+static const int WARP_BITS = 5;
+static const int WARP_SIZE = 1 << WARP_BITS;
+static const int WARP_SHIFT = 2 * WARP_BITS;
+static const int WARP_ROUND = 1 << (WARP_SHIFT - 1);
+
+// The rows warped at a time by each thread.
+static const int WARP_BAND_ROWS = 32;
+
+// The per-row kernels, in one version per instruction set.
+struct WarpKernels
+{
+    const char *name;
+
+    // Compute the fixed-point source positions (x and y) of count pixels of
+    // a row into xy, from the projective coordinates of the first, X0, Y0
+    // and W0, plus the steps[i], steps[count_max + i] and
+    // steps[2 * count_max + i] of the i-th (see column_steps).
+    void (*map_row)(double X0, double Y0, double W0, const double *steps,
+            int count_max, int *xy, int count);
+
+    // Interpolate count pixels of a row into dst, given their source
+    // positions in xy.
+    void (*interpolate_row)(const uchar *src, int src_step, CvSize src_size,
+            const int *xy, uchar *dst, int count);
+};
+
+// Round a source position to fixed point as OpenCV does, from its projective
+// coordinates.
+static inline void map_pixel(double X, double Y, double W, int *xy)
+{
+    W = (W != 0.0) ? WARP_SIZE / W : 0.0;
+    double fx = std::max(static_cast<double>(INT_MIN),
+            std::min(static_cast<double>(INT_MAX), X * W));
+    double fy = std::max(static_cast<double>(INT_MIN),
+            std::min(static_cast<double>(INT_MAX), Y * W));
+    xy[0] = cvRound(fx);
+    xy[1] = cvRound(fy);
+}
+
+static void map_row_scalar(double X0, double Y0, double W0,
+        const double *steps, int count_max, int *xy, int count)
+{
+    const double *x_steps = steps;
+    const double *y_steps = steps + count_max;
+    const double *w_steps = steps + 2 * count_max;
+    for (int i = 0; i < count; i++) {
+        map_pixel(X0 + x_steps[i], Y0 + y_steps[i], W0 + w_steps[i],
+                xy + 2 * i);
+    }
+}
+
+// Interpolate one pixel, taking any of its four neighbours that are outside
+// src to be black.
+static inline void interpolate_pixel(const uchar *src, int src_step,
+        CvSize src_size, int x, int y, uchar *dst)
+{
+    int sx = x >> WARP_BITS;
+    int sy = y >> WARP_BITS;
+    int wx[2] = { WARP_SIZE - (x & (WARP_SIZE - 1)), x & (WARP_SIZE - 1) };
+    int wy[2] = { WARP_SIZE - (y & (WARP_SIZE - 1)), y & (WARP_SIZE - 1) };
+
+    int sums[3] = { WARP_ROUND, WARP_ROUND, WARP_ROUND };
+    for (int dy = 0; dy < 2; dy++) {
+        if (sy + dy < 0 || sy + dy >= src_size.height) {
+            continue;
+        }
+        const uchar *row = src + (sy + dy) * src_step;
+        for (int dx = 0; dx < 2; dx++) {
+            if (sx + dx < 0 || sx + dx >= src_size.width) {
+                continue;
+            }
+            const uchar *pixel = row + (sx + dx) * 3;
+            int weight = wx[dx] * wy[dy];
+            sums[0] += pixel[0] * weight;
+            sums[1] += pixel[1] * weight;
+            sums[2] += pixel[2] * weight;
+        }
+    }
+    dst[0] = static_cast<uchar>(sums[0] >> WARP_SHIFT);
+    dst[1] = static_cast<uchar>(sums[1] >> WARP_SHIFT);
+    dst[2] = static_cast<uchar>(sums[2] >> WARP_SHIFT);
+}
+
+// Whether the SIMD kernels can load a pixel's neighbours directly: they read
+// 8 bytes from each of its two rows, so the pixel must be at least two
+// short of the right edge, and one short of the bottom.
+static inline bool is_inside(const int *xy, CvSize src_size)
+{
+    return static_cast<unsigned>(xy[0] >> WARP_BITS)
+                < static_cast<unsigned>(std::max(0, src_size.width - 2))
+            && static_cast<unsigned>(xy[1] >> WARP_BITS)
+                < static_cast<unsigned>(std::max(0, src_size.height - 1));
+}
+
+// The SIMD kernels interpolate a group of this many pixels at a time (when
+// they're all inside; see is_inside).
+static const int WARP_GROUP = 4;
+
+static inline bool is_group_inside(const int *xy, CvSize src_size)
+{
+    return is_inside(xy, src_size) && is_inside(xy + 2, src_size)
+            && is_inside(xy + 4, src_size) && is_inside(xy + 6, src_size);
+}
+
+// Store a group's pixels, given as 4 bytes each (the last of them unused)
+// in pixels: each of the first three 4-byte stores has its unused byte
+// overwritten by the next, and the last pixel is stored 3 bytes only, so
+// nothing past the group is written.
+static inline void store_group(const uchar *pixels, uchar *dst)
+{
+    std::memcpy(dst, pixels, 4);
+    std::memcpy(dst + 3, pixels + 4, 4);
+    std::memcpy(dst + 6, pixels + 8, 4);
+    std::memcpy(dst + 9, pixels + 12, 3);
+}
+
+static void interpolate_row_scalar(const uchar *src, int src_step,
+        CvSize src_size, const int *xy, uchar *dst, int count)
+{
+    for (int i = 0; i < count; i++) {
+        interpolate_pixel(src, src_step, src_size, xy[2 * i], xy[2 * i + 1],
+                dst + 3 * i);
+    }
+}
+
+#ifdef WARP_SSE2
+
+// Two pixels at a time, as OpenCV's SSE4.1 path does (with the same
+// operations, so the same results): the divisions are the bulk of the work.
+static void map_row_sse2(double X0, double Y0, double W0,
+        const double *steps, int count_max, int *xy, int count)
+{
+    const double *x_steps = steps;
+    const double *y_steps = steps + count_max;
+    const double *w_steps = steps + 2 * count_max;
+    const __m128d x0 = _mm_set1_pd(X0);
+    const __m128d y0 = _mm_set1_pd(Y0);
+    const __m128d w0 = _mm_set1_pd(W0);
+    const __m128d size = _mm_set1_pd(WARP_SIZE);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d min = _mm_set1_pd(INT_MIN);
+    const __m128d max = _mm_set1_pd(INT_MAX);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d w = _mm_add_pd(w0, _mm_loadu_pd(w_steps + i));
+        w = _mm_and_pd(_mm_cmpneq_pd(w, zero), _mm_div_pd(size, w));
+        __m128d fx = _mm_mul_pd(_mm_add_pd(x0, _mm_loadu_pd(x_steps + i)), w);
+        __m128d fy = _mm_mul_pd(_mm_add_pd(y0, _mm_loadu_pd(y_steps + i)), w);
+        __m128i x = _mm_cvtpd_epi32(_mm_max_pd(min, _mm_min_pd(max, fx)));
+        __m128i y = _mm_cvtpd_epi32(_mm_max_pd(min, _mm_min_pd(max, fy)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(xy + 2 * i),
+                _mm_unpacklo_epi32(x, y));
+    }
+    for (; i < count; i++) {
+        map_pixel(X0 + x_steps[i], Y0 + y_steps[i], W0 + w_steps[i],
+                xy + 2 * i);
+    }
+}
+
+// Blend two pixels, at the source positions xy[0..1] and xy[2..3], into 32
+// bits of sums per channel: the first pixel's channels in lanes 0-2 of
+// first, the second's in those of second.
+static inline void blend_pair_sse2(const uchar *src, int src_step,
+        const int *xy, __m128i &first, __m128i &second)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uchar *a = src + (xy[1] >> WARP_BITS) * src_step
+            + (xy[0] >> WARP_BITS) * 3;
+    const uchar *b = src + (xy[3] >> WARP_BITS) * src_step
+            + (xy[2] >> WARP_BITS) * 3;
+    int ax = xy[0] & (WARP_SIZE - 1);
+    int bx = xy[2] & (WARP_SIZE - 1);
+    int ay = xy[1] & (WARP_SIZE - 1);
+    int by = xy[3] & (WARP_SIZE - 1);
+
+    // Each row's two source pixels, widened to 16 bits, come with their
+    // channels in lanes 0-2 (left) and 3-5 (right). Gather the left ones of
+    // both pixels into one register, and the right ones into another
+    // (lanes 0-2 for the first pixel, 4-6 for the second), then blend them
+    // horizontally (which fits in 16 bits).
+    __m128i a_top = _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(a)), zero);
+    __m128i a_bottom = _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(a + src_step)), zero);
+    __m128i b_top = _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(b)), zero);
+    __m128i b_bottom = _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(b + src_step)), zero);
+    __m128i right_weight = _mm_set_epi16(bx, bx, bx, bx, ax, ax, ax, ax);
+    __m128i left_weight = _mm_sub_epi16(_mm_set1_epi16(WARP_SIZE),
+            right_weight);
+    __m128i top = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi64(a_top, b_top), left_weight),
+            _mm_mullo_epi16(_mm_unpacklo_epi64(_mm_srli_si128(a_top, 6),
+                _mm_srli_si128(b_top, 6)), right_weight));
+    __m128i bottom = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi64(a_bottom, b_bottom),
+                left_weight),
+            _mm_mullo_epi16(_mm_unpacklo_epi64(_mm_srli_si128(a_bottom, 6),
+                _mm_srli_si128(b_bottom, 6)), right_weight));
+
+    // Then the rows' blends vertically, as pairs of lanes, in 32 bits.
+    first = _mm_madd_epi16(_mm_unpacklo_epi16(top, bottom),
+            _mm_set1_epi32((ay << 16) | (WARP_SIZE - ay)));
+    second = _mm_madd_epi16(_mm_unpackhi_epi16(top, bottom),
+            _mm_set1_epi32((by << 16) | (WARP_SIZE - by)));
+}
+
+static void interpolate_row_sse2(const uchar *src, int src_step,
+        CvSize src_size, const int *xy, uchar *dst, int count)
+{
+    const __m128i round = _mm_set1_epi32(WARP_ROUND);
+    int i = 0;
+    for (; i + WARP_GROUP <= count; i += WARP_GROUP) {
+        const int *group_xy = xy + 2 * i;
+        if (!is_group_inside(group_xy, src_size)) {
+            interpolate_row_scalar(src, src_step, src_size, group_xy,
+                    dst + 3 * i, WARP_GROUP);
+            continue;
+        }
+        __m128i sums[WARP_GROUP];
+        blend_pair_sse2(src, src_step, group_xy, sums[0], sums[1]);
+        blend_pair_sse2(src, src_step, group_xy + 4, sums[2], sums[3]);
+        for (int k = 0; k < WARP_GROUP; k++) {
+            sums[k] = _mm_srai_epi32(_mm_add_epi32(sums[k], round),
+                    WARP_SHIFT);
+        }
+        uchar pixels[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels),
+                _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]),
+                    _mm_packs_epi32(sums[2], sums[3])));
+        store_group(pixels, dst + 3 * i);
+    }
+    interpolate_row_scalar(src, src_step, src_size, xy + 2 * i, dst + 3 * i,
+            count - i);
+}
+
+#endif
+
+#ifdef WARP_NEON
+
+// Blend two pixels, at the source positions xy[0..1] and xy[2..3], as the
+// SSE2 kernel does, into 8 bytes: the first pixel's channels in bytes 0-2,
+// the second's in bytes 4-6.
+static inline uint8x8_t blend_pair_neon(const uchar *src, int src_step,
+        const int *xy)
+{
+    const uchar *a = src + (xy[1] >> WARP_BITS) * src_step
+            + (xy[0] >> WARP_BITS) * 3;
+    const uchar *b = src + (xy[3] >> WARP_BITS) * src_step
+            + (xy[2] >> WARP_BITS) * 3;
+    uint16_t ax = static_cast<uint16_t>(xy[0] & (WARP_SIZE - 1));
+    uint16_t bx = static_cast<uint16_t>(xy[2] & (WARP_SIZE - 1));
+    uint16_t ay = static_cast<uint16_t>(xy[1] & (WARP_SIZE - 1));
+    uint16_t by = static_cast<uint16_t>(xy[3] & (WARP_SIZE - 1));
+
+    // Each row's two source pixels (lanes 0-2 and 3-5), the left ones of
+    // both pixels in one register and the right ones in another, blended
+    // horizontally.
+    uint16x8_t a_top = vmovl_u8(vld1_u8(a));
+    uint16x8_t a_bottom = vmovl_u8(vld1_u8(a + src_step));
+    uint16x8_t b_top = vmovl_u8(vld1_u8(b));
+    uint16x8_t b_bottom = vmovl_u8(vld1_u8(b + src_step));
+    uint16x8_t right_weight = vcombine_u16(vdup_n_u16(ax), vdup_n_u16(bx));
+    uint16x8_t left_weight = vsubq_u16(vdupq_n_u16(WARP_SIZE), right_weight);
+    uint16x8_t top = vmlaq_u16(
+            vmulq_u16(vcombine_u16(vget_low_u16(a_top), vget_low_u16(b_top)),
+                left_weight),
+            vcombine_u16(vget_low_u16(vextq_u16(a_top, a_top, 3)),
+                vget_low_u16(vextq_u16(b_top, b_top, 3))),
+            right_weight);
+    uint16x8_t bottom = vmlaq_u16(
+            vmulq_u16(vcombine_u16(vget_low_u16(a_bottom),
+                    vget_low_u16(b_bottom)), left_weight),
+            vcombine_u16(vget_low_u16(vextq_u16(a_bottom, a_bottom, 3)),
+                vget_low_u16(vextq_u16(b_bottom, b_bottom, 3))),
+            right_weight);
+
+    // Then the rows' blends vertically, in 32 bits, rounded back down.
+    uint32x4_t a_sums = vmlal_n_u16(
+            vmull_n_u16(vget_low_u16(top), WARP_SIZE - ay),
+            vget_low_u16(bottom), ay);
+    uint32x4_t b_sums = vmlal_n_u16(
+            vmull_n_u16(vget_high_u16(top), WARP_SIZE - by),
+            vget_high_u16(bottom), by);
+    return vmovn_u16(vcombine_u16(vrshrn_n_u32(a_sums, WARP_SHIFT),
+            vrshrn_n_u32(b_sums, WARP_SHIFT)));
+}
+
+static void interpolate_row_neon(const uchar *src, int src_step,
+        CvSize src_size, const int *xy, uchar *dst, int count)
+{
+    int i = 0;
+    for (; i + WARP_GROUP <= count; i += WARP_GROUP) {
+        const int *group_xy = xy + 2 * i;
+        if (!is_group_inside(group_xy, src_size)) {
+            interpolate_row_scalar(src, src_step, src_size, group_xy,
+                    dst + 3 * i, WARP_GROUP);
+            continue;
+        }
+        uchar pixels[16];
+        vst1q_u8(pixels, vcombine_u8(blend_pair_neon(src, src_step, group_xy),
+                blend_pair_neon(src, src_step, group_xy + 4)));
+        store_group(pixels, dst + 3 * i);
+    }
+    interpolate_row_scalar(src, src_step, src_size, xy + 2 * i, dst + 3 * i,
+            count - i);
+}
+
+#endif
+
+// Pick the kernel the CPU supports (once).
+static const WarpKernels &warp_kernels()
+{
+    static const WarpKernels kernels = []() -> WarpKernels {
+#ifdef WARP_SSE2
+        WarpKernels sse2 = { "sse2", map_row_sse2, interpolate_row_sse2 };
+        return sse2;
+#endif
+#ifdef WARP_NEON
+        // (Rows are mapped with the scalar code, as 32-bit ARM has no
+        // double-precision NEON.)
+        WarpKernels neon = { "neon", map_row_scalar, interpolate_row_neon };
+        return neon;
+#endif
+        WarpKernels scalar = { "scalar", map_row_scalar,
+                interpolate_row_scalar };
+        return scalar;
+    }();
+    return kernels;
+}
+
+const char *warp_kernel_name()
+{
+    return warp_kernels().name;
+}
+
+void warp_perspective(const IplImage *src, IplImage *dst, const CvMat *h,
+        int max_threads)
+{
+    if (dst->width <= 0 || dst->height <= 0) {
+        return;
+    }
+
+    // Map dst pixels back into src.
+    double m[9];
+    CvMat m_mat = cvMat(3, 3, CV_64FC1, m);
+    cvInvert(h, &m_mat);
+
+    // The source positions of each row are computed a block at a time from
+    // the block's first, in the same blocks as OpenCV's warpPerspective, so
+    // that they round the same way. The column steps from a block's first
+    // pixel are the same for every block, so they're computed once.
+    int block_height = std::min(16, dst->height);
+    int block_width = std::min(32 * 32 / block_height, dst->width);
+    std::vector<double> column_steps(3 * block_width);
+    for (int i = 0; i < block_width; i++) {
+        column_steps[i] = m[0] * i;
+        column_steps[block_width + i] = m[3] * i;
+        column_steps[2 * block_width + i] = m[6] * i;
+    }
+
+    const uchar *src_data = reinterpret_cast<const uchar *>(src->imageData);
+    CvSize src_size = cvGetSize(src);
+    const WarpKernels &kernels = warp_kernels();
+    int bands = (dst->height + WARP_BAND_ROWS - 1) / WARP_BAND_ROWS;
+    parallel_for(bands, max_threads, [&](int band) {
+        std::vector<int> xy(2 * block_width);
+        int end_y = std::min(dst->height, (band + 1) * WARP_BAND_ROWS);
+        for (int y = band * WARP_BAND_ROWS; y < end_y; y++) {
+            uchar *dst_row = reinterpret_cast<uchar *>(dst->imageData)
+                    + y * dst->widthStep;
+            for (int x = 0; x < dst->width; x += block_width) {
+                int count = std::min(block_width, dst->width - x);
+                kernels.map_row(m[0] * x + m[1] * y + m[2],
+                        m[3] * x + m[4] * y + m[5],
+                        m[6] * x + m[7] * y + m[8],
+                        &column_steps[0], block_width, &xy[0], count);
+                kernels.interpolate_row(src_data, src->widthStep, src_size,
+                        &xy[0], dst_row + 3 * x, count);
+            }
+        }
+    });
+}
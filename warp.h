@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2012, 2016, Yutaka Tsutano
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _WARP_H
+#define _WARP_H
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+// Warp an 8-bit, 3-channel image into dst (also 8-bit, 3-channel) through
+// the perspective transform h (a 3x3 CV_64FC1 matrix taking src positions to
+// dst positions), interpolating bilinearly; pixels that come from outside
+// src are black. (Neither image may have an ROI.) The result is that of
+//
+//     cvWarpPerspective(src, dst, h)
+//
+// to within a gray level (the source positions and interpolation weights are
+// computed as OpenCV does, in the same fixed point), but dst is split into
+// bands of rows warped on up to max_threads threads (0 for one per hardware
+// core) of the parallel_for pool, so callers that are already running in
+// parallel share the cores rather than start more threads. The positions
+// and the interpolation are computed several pixels at a time in SSE2 or
+// NEON where the CPU has them.
+void warp_perspective(const IplImage *src, IplImage *dst, const CvMat *h,
+        int max_threads = 0);
+
+// The name of the instruction set the warp interpolates with on this CPU
+// ("sse2", "neon" or "scalar").
+const char *warp_kernel_name();
+
+#endif